@@ -1,5 +1,5 @@
 #!/bin/bash
-#cat /home/ljx/label_data/fold_1/*.csv | bin/estimate --dim 3 > fold_1/estimate.out 2> fold_1/estimate.err
-cat /home/ljx/label_data/fold_2/*.csv | bin/estimate --dim 3 > fold_2/estimate.out 2> fold_2/estimate.err &
-cat /home/ljx/label_data/fold_3/*.csv | bin/estimate --dim 3 > fold_3/estimate.out 2> fold_3/estimate.err &
-cat /home/ljx/label_data/fold_4/*.csv | bin/estimate --dim 3 > fold_4/estimate.out 2> fold_4/estimate.err &
\ No newline at end of file
+#bin/estimate --dim 3 --input "/home/ljx/label_data/fold_1/*.csv" > fold_1/estimate.out 2> fold_1/estimate.err
+bin/estimate --dim 3 --input "/home/ljx/label_data/fold_2/*.csv" > fold_2/estimate.out 2> fold_2/estimate.err &
+bin/estimate --dim 3 --input "/home/ljx/label_data/fold_3/*.csv" > fold_3/estimate.out 2> fold_3/estimate.err &
+bin/estimate --dim 3 --input "/home/ljx/label_data/fold_4/*.csv" > fold_4/estimate.out 2> fold_4/estimate.err &
\ No newline at end of file
@@ -0,0 +1,134 @@
+/*
+ * Channel.cpp
+ *
+ * Copyright (C) 2016  Akira Kinoshita <kinoshita@nii.ac.jp>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "Channel.h"
+#include "PmmError.h"
+
+#include <iostream>
+#include <cstring>
+#include <cerrno>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+
+Channel::Channel(int fd) :
+		_fd(fd) {
+}
+
+Channel::~Channel() {
+	close(_fd);
+}
+
+void Channel::send(const void *buf, size_t bytes) {
+	const char *p = (const char *) buf;
+	while (bytes > 0) {
+		ssize_t w = write(_fd, p, bytes);
+		if (w < 0) {
+			if (errno == EINTR)
+				continue;
+			failErrno("write");
+		}
+		p += w;
+		bytes -= (size_t) w;
+	}
+}
+
+void Channel::receive(void *buf, size_t bytes) {
+	char *p = (char *) buf;
+	while (bytes > 0) {
+		ssize_t r = read(_fd, p, bytes);
+		if (r < 0) {
+			if (errno == EINTR)
+				continue;
+			failErrno("read");
+		}
+		if (r == 0) {
+			fail("channel closed by peer.");
+		}
+		p += r;
+		bytes -= (size_t) r;
+	}
+}
+
+void Channel::sendSize(size_t v) {
+	send(&v, sizeof(size_t));
+}
+
+size_t Channel::receiveSize(void) {
+	size_t v;
+	receive(&v, sizeof(size_t));
+	return v;
+}
+
+void Channel::createPair(Channel*& a, Channel*& b) {
+	int fds[2];
+	if (socketpair(AF_UNIX, SOCK_STREAM, 0, fds) < 0)
+		failErrno("socketpair");
+	a = new Channel(fds[0]);
+	b = new Channel(fds[1]);
+}
+
+static void unixAddress(const char *path, struct sockaddr_un& addr) {
+	memset(&addr, 0, sizeof(addr));
+	addr.sun_family = AF_UNIX;
+	if (strlen(path) >= sizeof(addr.sun_path)) {
+		fail("socket path too long: ", path);
+	}
+	strcpy(addr.sun_path, path);
+}
+
+int Channel::listenUnix(const char *path) {
+	struct sockaddr_un addr;
+	unixAddress(path, addr);
+	int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+	if (fd < 0)
+		failErrno("socket");
+	unlink(path);
+	if (bind(fd, (struct sockaddr *) &addr, sizeof(addr)) < 0)
+		failErrno("bind");
+	if (listen(fd, SOMAXCONN) < 0)
+		failErrno("listen");
+	return fd;
+}
+
+Channel* Channel::acceptUnix(int fd) {
+	int c;
+	while ((c = accept(fd, NULL, NULL)) < 0) {
+		if (errno != EINTR)
+			failErrno("accept");
+	}
+	return new Channel(c);
+}
+
+/* connect to a listening socket, waiting up to ~10 s for it to appear */
+Channel* Channel::connectUnix(const char *path) {
+	struct sockaddr_un addr;
+	unixAddress(path, addr);
+	for (int retry = 0;; retry++) {
+		int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+		if (fd < 0)
+			failErrno("socket");
+		if (connect(fd, (struct sockaddr *) &addr, sizeof(addr)) == 0)
+			return new Channel(fd);
+		close(fd);
+		if ((errno != ENOENT && errno != ECONNREFUSED) || retry >= 100)
+			failErrno("connect");
+		usleep(100000);
+	}
+}
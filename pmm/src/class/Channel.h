@@ -0,0 +1,53 @@
+/*
+ * Channel.h
+ *
+ * Copyright (C) 2016  Akira Kinoshita <kinoshita@nii.ac.jp>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef SRC_CLASS_CHANNEL_H_
+#define SRC_CLASS_CHANNEL_H_
+
+#include <cstddef>
+
+/*
+ * Blocking, message-oriented connection between the coordinator and a
+ * worker of sharded EM over a stream file descriptor (a socketpair for
+ * forked workers, or a Unix domain socket).
+ */
+class Channel {
+private:
+	/* private member variables */
+	int _fd;
+
+public:
+	/* constructor & destructor */
+	Channel(int fd);
+	virtual ~Channel();
+
+	/* public member functions */
+	void send(const void *buf, size_t bytes);
+	void receive(void *buf, size_t bytes);
+	void sendSize(size_t v);
+	size_t receiveSize(void);
+
+	/* factories */
+	static void createPair(Channel*& a, Channel*& b);
+	static int listenUnix(const char *path);
+	static Channel* acceptUnix(int fd);
+	static Channel* connectUnix(const char *path);
+};
+
+#endif /* SRC_CLASS_CHANNEL_H_ */
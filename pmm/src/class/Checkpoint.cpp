@@ -0,0 +1,179 @@
+/*
+ * Checkpoint.cpp
+ *
+ * Copyright (C) 2016  Akira Kinoshita <kinoshita@nii.ac.jp>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "Checkpoint.h"
+#include "PmmError.h"
+
+#include <cstdio>
+#include <utility>
+
+static void writeSize(FILE *fp, size_t x) {
+	if (fwrite(&x, sizeof(size_t), 1, fp) != 1)
+		failErrno("fwrite");
+}
+
+static void writeDoubles(FILE *fp, const std::vector<double>& v) {
+	writeSize(fp, v.size());
+	if (!v.empty() && fwrite(v.data(), sizeof(double), v.size(), fp) != v.size())
+		failErrno("fwrite");
+}
+
+static void writeSizes(FILE *fp, const std::vector<size_t>& v) {
+	writeSize(fp, v.size());
+	if (!v.empty() && fwrite(v.data(), sizeof(size_t), v.size(), fp) != v.size())
+		failErrno("fwrite");
+}
+
+static size_t readSize(FILE *fp, const char *path) {
+	size_t x;
+	if (fread(&x, sizeof(size_t), 1, fp) != 1)
+		fail(path, ": truncated checkpoint");
+	return x;
+}
+
+static void readDoubles(FILE *fp, const char *path, std::vector<double>& v) {
+	v.resize(readSize(fp, path));
+	if (!v.empty() && fread(v.data(), sizeof(double), v.size(), fp) != v.size())
+		fail(path, ": truncated checkpoint");
+}
+
+static void readSizes(FILE *fp, const char *path, std::vector<size_t>& v) {
+	v.resize(readSize(fp, path));
+	if (!v.empty() && fread(v.data(), sizeof(size_t), v.size(), fp) != v.size())
+		fail(path, ": truncated checkpoint");
+}
+
+/*
+ * Format: PMM_CHECKPOINT_MAGIC, then the fields in declaration order; sizes
+ * are size_t, vectors are their length followed by the elements, and the RNG
+ * state is its length followed by the characters.
+ */
+void Checkpoint::write(const char *path) const {
+	FILE *fp = fopen(path, "wb");
+	if (fp == NULL)
+		failErrno(path);
+	try {
+		writeSize(fp, PMM_CHECKPOINT_MAGIC);
+		writeSize(fp, K);
+		writeSize(fp, D);
+		writeSize(fp, nSegments);
+		writeSize(fp, idHash);
+		writeSize(fp, iteration);
+		writeSize(fp, nConverged);
+		writeDoubles(fp, loglik);
+		writeSize(fp, rng.size());
+		if (fwrite(rng.data(), 1, rng.size(), fp) != rng.size())
+			failErrno("fwrite");
+		writeSize(fp, nLazyItr);
+		writeSize(fp, nSparseItr);
+		writeDoubles(fp, params);
+		writeDoubles(fp, theta);
+		writeDoubles(fp, lazyParams);
+		writeSizes(fp, segParamsAt);
+		writeDoubles(fp, segStats);
+		writeDoubles(fp, thetaChange);
+		writeSize(fp, nMiniBatchItr);
+		writeDoubles(fp, batchStats);
+		if (fflush(fp) != 0)
+			failErrno("fflush");
+	} catch (...) {
+		fclose(fp);
+		throw;
+	}
+	if (fclose(fp) != 0)
+		failErrno("fclose");
+}
+
+void Checkpoint::read(const char *path) {
+	FILE *fp = fopen(path, "rb");
+	if (fp == NULL)
+		failErrno(path);
+	try {
+		if (readSize(fp, path) != PMM_CHECKPOINT_MAGIC)
+			fail(path, ": not a checkpoint");
+		K = readSize(fp, path);
+		D = readSize(fp, path);
+		nSegments = readSize(fp, path);
+		idHash = readSize(fp, path);
+		iteration = readSize(fp, path);
+		nConverged = readSize(fp, path);
+		readDoubles(fp, path, loglik);
+		rng.resize(readSize(fp, path));
+		if (fread(&rng[0], 1, rng.size(), fp) != rng.size())
+			fail(path, ": truncated checkpoint");
+		nLazyItr = readSize(fp, path);
+		nSparseItr = readSize(fp, path);
+		readDoubles(fp, path, params);
+		readDoubles(fp, path, theta);
+		readDoubles(fp, path, lazyParams);
+		readSizes(fp, path, segParamsAt);
+		readDoubles(fp, path, segStats);
+		readDoubles(fp, path, thetaChange);
+		nMiniBatchItr = readSize(fp, path);
+		readDoubles(fp, path, batchStats);
+	} catch (...) {
+		fclose(fp);
+		throw;
+	}
+	fclose(fp);
+	if (theta.size() != nSegments * K || loglik.size() != iteration)
+		fail(path, ": inconsistent checkpoint");
+}
+
+CheckpointWriter::CheckpointWriter(const std::string& path) :
+		_path(path) {
+}
+
+CheckpointWriter::~CheckpointWriter() {
+	if (_writer.joinable())
+		_writer.join();
+}
+
+void CheckpointWriter::_write(void) {
+	try {
+		std::string tmp = _path + ".tmp";
+		_pending.write(tmp.c_str());
+		if (rename(tmp.c_str(), _path.c_str()) != 0)
+			failErrno("rename");
+	} catch (...) {
+		_error = std::current_exception();
+	}
+}
+
+/*
+ * Write c (which is taken over) once the previous checkpoint is written,
+ * and return without waiting.  An error of the previous write is raised
+ * here.
+ */
+void CheckpointWriter::submit(Checkpoint& c) {
+	finish();
+	std::swap(_pending, c);
+	_writer = std::thread(&CheckpointWriter::_write, this);
+}
+
+/* wait for the last checkpoint and raise its error, if any */
+void CheckpointWriter::finish(void) {
+	if (_writer.joinable())
+		_writer.join();
+	if (_error) {
+		std::exception_ptr e = _error;
+		_error = nullptr;
+		std::rethrow_exception(e);
+	}
+}
@@ -0,0 +1,90 @@
+/*
+ * Checkpoint.h
+ *
+ * Copyright (C) 2016  Akira Kinoshita <kinoshita@nii.ac.jp>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef SRC_CLASS_CHECKPOINT_H_
+#define SRC_CLASS_CHECKPOINT_H_
+
+#include <cstdio>
+#include <string>
+#include <vector>
+#include <thread>
+#include <exception>
+
+#define PMM_CHECKPOINT_MAGIC ((size_t) 0x03706d6d636b7074ULL)
+
+/*
+ * State of an EM run after some iteration: everything needed to continue
+ * it with the same result as if it had not been interrupted.  The model
+ * part is filled by TopicModel::saveCheckpoint(), the rest by the caller.
+ */
+class Checkpoint {
+public:
+	/* the data set and the model it belongs to */
+	size_t K, D, nSegments;
+	size_t idHash; /* of the segment IDs in order */
+
+	/* EM loop */
+	size_t iteration; /* completed iterations */
+	size_t nConverged; /* consecutive iterations passing the test */
+	std::vector<double> loglik; /* of each completed iteration */
+
+	/* model */
+	std::string rng; /* state of the model's std::mt19937 */
+	size_t nLazyItr, nSparseItr;
+	std::vector<double> params; /* distribution parameters */
+	std::vector<double> theta; /* nSegments x K */
+	std::vector<double> lazyParams; /* lazy EM caches; empty if unused */
+	std::vector<size_t> segParamsAt;
+	std::vector<double> segStats;
+	std::vector<double> thetaChange;
+	size_t nMiniBatchItr; /* mini-batch EM; batchStats empty if unused */
+	std::vector<double> batchStats;
+
+	/* public member functions */
+	void write(const char *path) const;
+	void read(const char *path);
+};
+
+/*
+ * Writes checkpoints in a background thread, one at a time.  The file is
+ * written next to the target and renamed, so an interrupted write never
+ * destroys the previous checkpoint.
+ */
+class CheckpointWriter {
+private:
+	/* private member variables */
+	std::string _path;
+	Checkpoint _pending;
+	std::thread _writer;
+	std::exception_ptr _error; /* raised in the writer thread */
+
+	/* private member functions */
+	void _write(void);
+
+public:
+	/* constructor & destructor */
+	CheckpointWriter(const std::string& path);
+	virtual ~CheckpointWriter();
+
+	/* public member functions */
+	void submit(Checkpoint& c);
+	void finish(void);
+};
+
+#endif /* SRC_CLASS_CHECKPOINT_H_ */
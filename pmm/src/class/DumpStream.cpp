@@ -0,0 +1,163 @@
+/*
+ * DumpStream.cpp
+ *
+ * Copyright (C) 2016  Akira Kinoshita <kinoshita@nii.ac.jp>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "DumpStream.h"
+#include "PmmError.h"
+
+DumpStream::DumpStream(FILE *fp, size_t bufferBytes) :
+		_fp(fp), _chunkBytes(bufferBytes / 2) {
+	_filled[0] = _filled[1] = false;
+	_stop = false;
+	_current = 0;
+}
+
+DumpStream::~DumpStream() {
+	endPass();
+	fclose(_fp); /* read only; nothing to lose */
+}
+
+size_t DumpStream::size(void) {
+	return _entries.size();
+}
+
+size_t DumpStream::nData(size_t i) {
+	return _entries[i].nData;
+}
+
+size_t DumpStream::bytes(size_t i) {
+	return _entries[i].bytes;
+}
+
+/* the two buffers (when filled) and the index */
+size_t DumpStream::memoryBytes(void) {
+	return 2 * _chunkBytes + _entries.capacity() * sizeof(Entry)
+			+ _chunks.capacity() * sizeof(Chunk);
+}
+
+/*
+ * Register the data block of the next segment.
+ * Blocks must be added in file order.  A chunk is closed when the next block
+ * does not fit in it any more; a single block larger than the budget forms a
+ * chunk on its own.
+ */
+void DumpStream::addSegment(size_t nData, long offset, size_t bytes) {
+	Entry e = { nData, offset, bytes };
+	size_t i = _entries.size();
+	_entries.push_back(e);
+
+	if (!_chunks.empty()) {
+		Chunk& c = _chunks.back();
+		size_t span = (size_t) (offset - c.offset) + bytes;
+		if (span <= _chunkBytes) {
+			c.last = i + 1;
+			c.bytes = span;
+			return;
+		}
+	}
+	Chunk c = { i, i + 1, offset, bytes };
+	_chunks.push_back(c);
+}
+
+/* reader thread; an error is handed over to the caller of nextChunk() */
+void DumpStream::_readChunks(void) {
+	try {
+		_readChunksOrFail();
+	} catch (...) {
+		{
+			std::lock_guard<std::mutex> lock(_mutex);
+			_error = std::current_exception();
+		}
+		_cond.notify_all();
+	}
+}
+
+void DumpStream::_readChunksOrFail(void) {
+	for (size_t c = 0; c < _chunks.size(); c++) {
+		size_t b = c % 2;
+		{
+			std::unique_lock<std::mutex> lock(_mutex);
+			_cond.wait(lock, [&] {return _stop || !_filled[b];});
+			if (_stop)
+				return;
+		}
+		std::vector<char>& buf = _buffers[b];
+		buf.resize(_chunks[c].bytes);
+		if (fseek(_fp, _chunks[c].offset, SEEK_SET) < 0)
+			failErrno("fseek");
+		if (fread(buf.data(), sizeof(char), buf.size(), _fp) != buf.size())
+			failErrno("fread");
+		{
+			std::lock_guard<std::mutex> lock(_mutex);
+			_filled[b] = true;
+		}
+		_cond.notify_all();
+	}
+}
+
+/* start prefetching the first chunks of a new pass */
+void DumpStream::beginPass(void) {
+	endPass();
+	_filled[0] = _filled[1] = false;
+	_stop = false;
+	_error = nullptr;
+	_current = 0;
+	_reader = std::thread(&DumpStream::_readChunks, this);
+}
+
+/*
+ * Release the current chunk and wait for the next one.
+ * Returns false when the pass is over.
+ */
+bool DumpStream::nextChunk(size_t& first, size_t& last) {
+	std::unique_lock<std::mutex> lock(_mutex);
+	if (_current > 0) {
+		_filled[(_current - 1) % 2] = false;
+		_cond.notify_all();
+	}
+	if (_current == _chunks.size())
+		return false;
+	size_t b = _current % 2;
+	_cond.wait(lock, [&] {return _filled[b] || _error;});
+	if (_error) {
+		std::exception_ptr e = _error;
+		_error = nullptr;
+		std::rethrow_exception(e);
+	}
+	first = _chunks[_current].first;
+	last = _chunks[_current].last;
+	++_current;
+	return true;
+}
+
+/* data block of segment i, which must belong to the current chunk */
+const char* DumpStream::segmentData(size_t i) {
+	const Chunk& c = _chunks[_current - 1];
+	return _buffers[(_current - 1) % 2].data() + (_entries[i].offset - c.offset);
+}
+
+void DumpStream::endPass(void) {
+	if (_reader.joinable()) {
+		{
+			std::lock_guard<std::mutex> lock(_mutex);
+			_stop = true;
+		}
+		_cond.notify_all();
+		_reader.join();
+	}
+}
@@ -0,0 +1,89 @@
+/*
+ * DumpStream.h
+ *
+ * Copyright (C) 2016  Akira Kinoshita <kinoshita@nii.ac.jp>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef SRC_CLASS_DUMPSTREAM_H_
+#define SRC_CLASS_DUMPSTREAM_H_
+
+#include <cstdio>
+#include <vector>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <exception>
+
+/*
+ * Double-buffered sequential reader of segment data in a dump file.
+ *
+ * Segments are registered once (file offset and size of their data block)
+ * and grouped into chunks that fit in half of the buffer budget.  During a
+ * pass, a reader thread fills one buffer while the caller works on the
+ * other, so at most two chunks are held in memory at a time.
+ */
+class DumpStream {
+private:
+	struct Entry {
+		size_t nData; /* number of records */
+		long offset; /* file offset of the data block */
+		size_t bytes; /* size of the data block */
+	};
+	struct Chunk {
+		size_t first, last; /* entries [first, last) */
+		long offset;
+		size_t bytes;
+	};
+
+	/* private member variables */
+	FILE *_fp;
+	const size_t _chunkBytes; /* preferred upper bound of a chunk */
+	std::vector<Entry> _entries;
+	std::vector<Chunk> _chunks;
+	std::vector<char> _buffers[2];
+
+	std::thread _reader;
+	std::mutex _mutex;
+	std::condition_variable _cond;
+	bool _filled[2];
+	bool _stop;
+	std::exception_ptr _error; /* raised in the reader thread */
+	size_t _current; /* chunk in use + 1; 0 before the first one */
+
+	/* private member functions */
+	void _readChunks(void);
+	void _readChunksOrFail(void);
+
+public:
+	/* constructor & destructor */
+	DumpStream(FILE *fp, size_t bufferBytes);
+	virtual ~DumpStream();
+
+	/* getter */
+	size_t size(void);
+	size_t nData(size_t i);
+	size_t bytes(size_t i);
+	size_t memoryBytes(void);
+
+	/* public member functions */
+	void addSegment(size_t nData, long offset, size_t bytes);
+	void beginPass(void);
+	bool nextChunk(size_t& first, size_t& last);
+	const char* segmentData(size_t i);
+	void endPass(void);
+};
+
+#endif /* SRC_CLASS_DUMPSTREAM_H_ */
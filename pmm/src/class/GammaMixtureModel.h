@@ -0,0 +1,82 @@
+/*
+ * GammaMixtureModel.h
+ *
+ * Copyright (C) 2016  Akira Kinoshita <kinoshita@nii.ac.jp>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef SRC_CLASS_GAMMAMIXTUREMODEL_H_
+#define SRC_CLASS_GAMMAMIXTUREMODEL_H_
+
+#include "TopicModel.h"
+#include <valarray>
+#include "SegmentObservingVector.h"
+
+/*
+ * Mixture of gamma distributions for positive real values (e.g. speeds).
+ * Component k has shape a and rate b in each dimension d, stored as
+ * _distParams[k][2 * d] and _distParams[k][2 * d + 1].
+ */
+class GammaMixtureModel: public TopicModel<SegmentObservingVector<double>> {
+private:
+	/* private member variables */
+	std::vector<std::valarray<double>> _distParams;
+	std::vector<std::valarray<double>> _logNorm; /* a log b - log Gamma(a) */
+
+	/* private member functions */
+	bool _isValid(double *dataPoint);
+	void _addData(std::vector<SegmentObservingVector<double>*>& table,
+			SegmentIdTable& ids, const char *id, size_t len,
+			double *dataPoint, const int64_t *time,
+			bool forceadd);
+	double _mean(size_t k, size_t d);
+	void _updateNormalizers(void);
+	void _solveShapes(const std::valarray<double>& s, std::valarray<double>& a);
+
+protected:
+	/* protected member interface implementation */
+	virtual bool _readDataFileLine(
+			std::vector<SegmentObservingVector<double>*>& table,
+			SegmentIdTable& ids, char *buf, bool forceadd);
+	virtual bool _loadSegmentDataFromDump(FILE *fp);
+	virtual bool _saveSegmentDataToDump(FILE *fp,
+			SegmentObservingVector<double>* seg);
+	virtual void _dumpTopicParamsAndSegments(void);
+	virtual void _Mstep(void);
+	virtual double _numberOfModelParameters(void);
+	virtual double _pdf(size_t s, size_t n, size_t k);
+	virtual size_t _bytesPerRecord(void);
+	virtual size_t _numberOfSufficientStatistics(void);
+	virtual double _pdfOfRecord(const double *x, size_t k);
+	virtual void _accumulateSufficientStatistics(const double *x,
+			const double *gamma, double *stats);
+	virtual void _updateDistParams(const double *stats);
+	virtual size_t _numberOfDistParams(void);
+	virtual void _getDistParams(double *params);
+	virtual void _setDistParams(const double *params);
+	virtual void _initDistParamsFromCenters(const double *centers);
+	virtual double _logPdfChange(const double *from, const double *to,
+			const double *lo, const double *hi);
+
+public:
+	/* constructor & destructor */
+	GammaMixtureModel(size_t k, size_t d, bool doSrand);
+	GammaMixtureModel(size_t k, size_t d);
+
+	/* public member interface implementation */
+	virtual void validateDataset(void);
+};
+
+#endif /* SRC_CLASS_GAMMAMIXTUREMODEL_H_ */
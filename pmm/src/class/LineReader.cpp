@@ -0,0 +1,138 @@
+/*
+ * LineReader.cpp
+ *
+ * Copyright (C) 2016  Akira Kinoshita <kinoshita@nii.ac.jp>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "LineReader.h"
+#include "PmmError.h"
+
+#include <cstring>
+
+LineReader::LineReader(FILE *fp, size_t blockBytes, size_t nBuffers) :
+		_fp(fp), _blockBytes(blockBytes), _buffers(nBuffers),
+		_lengths(nBuffers, 0) {
+	_nFilled = 0;
+	_nTaken = 0;
+	_nReleased = 0;
+	_eof = false;
+	_stop = false;
+	_reader = std::thread(&LineReader::_readBlocks, this);
+}
+
+LineReader::~LineReader() {
+	{
+		std::lock_guard<std::mutex> lock(_mutex);
+		_stop = true;
+	}
+	_cond.notify_all();
+	_reader.join();
+}
+
+/* reader thread; an error is handed over to the caller of next() */
+void LineReader::_readBlocks(void) {
+	try {
+		_readBlocksOrFail();
+	} catch (...) {
+		std::lock_guard<std::mutex> lock(_mutex);
+		_error = std::current_exception();
+	}
+	{
+		std::lock_guard<std::mutex> lock(_mutex);
+		_eof = true;
+	}
+	_cond.notify_all();
+}
+
+/*
+ * Each block starts with the incomplete last line of the previous one and
+ * ends after its own last newline; a line longer than a block makes the
+ * block grow.  The final line needs no newline.
+ */
+void LineReader::_readBlocksOrFail(void) {
+	std::vector<char> carry; /* incomplete line after the last block */
+	bool eof = false;
+	while (!eof) {
+		size_t b = _nFilled % _buffers.size();
+		{
+			std::unique_lock<std::mutex> lock(_mutex);
+			_cond.wait(lock, [&] {
+				return _stop || _nFilled - _nReleased < _buffers.size();});
+			if (_stop)
+				return;
+		}
+		std::vector<char>& buf = _buffers[b];
+		buf.assign(carry.begin(), carry.end());
+		size_t len;
+		for (;;) {
+			size_t old = buf.size();
+			buf.resize(old + _blockBytes);
+			size_t n = fread(buf.data() + old, sizeof(char), _blockBytes, _fp);
+			buf.resize(old + n);
+			if (n < _blockBytes) {
+				if (ferror(_fp))
+					failErrno("fread");
+				eof = true;
+				len = buf.size();
+				break;
+			}
+			const char *nl = (const char *) memrchr(buf.data() + old, '\n', n);
+			if (nl != NULL) {
+				len = nl - buf.data() + 1;
+				break;
+			}
+		}
+		carry.assign(buf.begin() + len, buf.end());
+		buf.resize(len);
+		buf.push_back('\0');
+		if (len == 0)
+			break;
+		{
+			std::lock_guard<std::mutex> lock(_mutex);
+			_lengths[b] = len;
+			++_nFilled;
+		}
+		_cond.notify_all();
+	}
+}
+
+/*
+ * Wait for the next block and return it ('\0'-terminated, len bytes of
+ * whole lines), or NULL at the end of the stream.
+ */
+char* LineReader::next(size_t& len) {
+	std::unique_lock<std::mutex> lock(_mutex);
+	_cond.wait(lock, [&] {return _nTaken < _nFilled || _eof;});
+	if (_error) {
+		std::exception_ptr e = _error;
+		_error = nullptr;
+		std::rethrow_exception(e);
+	}
+	if (_nTaken == _nFilled)
+		return NULL;
+	size_t b = _nTaken++ % _buffers.size();
+	len = _lengths[b];
+	return _buffers[b].data();
+}
+
+/* give back the oldest block taken by next() */
+void LineReader::release(void) {
+	{
+		std::lock_guard<std::mutex> lock(_mutex);
+		++_nReleased;
+	}
+	_cond.notify_all();
+}
@@ -0,0 +1,69 @@
+/*
+ * LineReader.h
+ *
+ * Copyright (C) 2016  Akira Kinoshita <kinoshita@nii.ac.jp>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef SRC_CLASS_LINEREADER_H_
+#define SRC_CLASS_LINEREADER_H_
+
+#include <cstdio>
+#include <vector>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <exception>
+
+/*
+ * Reads a text stream (e.g. a pipe) in large blocks of whole lines.
+ *
+ * A reader thread fills a ring of buffers ahead of the caller, so that
+ * reading overlaps with parsing.  Blocks are handed out in stream order
+ * by next() and must be given back, oldest first, by release().
+ */
+class LineReader {
+private:
+	/* private member variables */
+	FILE *_fp;
+	const size_t _blockBytes; /* bytes read at a time */
+	std::vector<std::vector<char>> _buffers;
+	std::vector<size_t> _lengths; /* of the lines in each buffer */
+
+	std::thread _reader;
+	std::mutex _mutex;
+	std::condition_variable _cond;
+	size_t _nFilled; /* blocks read so far */
+	size_t _nTaken; /* blocks handed out by next() */
+	size_t _nReleased; /* blocks given back */
+	bool _eof;
+	bool _stop;
+	std::exception_ptr _error; /* raised in the reader thread */
+
+	/* private member functions */
+	void _readBlocks(void);
+	void _readBlocksOrFail(void);
+
+public:
+	/* constructor & destructor */
+	LineReader(FILE *fp, size_t blockBytes, size_t nBuffers);
+	virtual ~LineReader();
+
+	/* public member functions */
+	char* next(size_t& len);
+	void release(void);
+};
+
+#endif /* SRC_CLASS_LINEREADER_H_ */
@@ -0,0 +1,273 @@
+/*
+ * ModelBank.cpp
+ *
+ * Copyright (C) 2016  Akira Kinoshita <kinoshita@nii.ac.jp>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "ModelBank.h"
+#include "PmmError.h"
+
+#include <cmath>
+#include <cinttypes>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+#include <algorithm>
+#include <gsl/gsl_sf_gamma.h>
+
+ModelBank::ModelBank() :
+		_nSlots(0), _period(0), _slotWidth(0) {
+}
+
+ModelBank::~ModelBank() {
+}
+
+size_t ModelBank::slots(void) const {
+	return _nSlots;
+}
+
+size_t ModelBank::size(void) const {
+	return _ids.size();
+}
+
+size_t ModelBank::K(size_t slot) const {
+	return _first[slot + 1] - _first[slot];
+}
+
+static void badBank(const std::string& line) {
+	fail("invalid bank file near: ", line);
+}
+
+/* read a line and strip its '\n'; false at the end of the file */
+static bool nextLine(FILE *fp, char *&buf, size_t& bufSize) {
+	ssize_t len = getline(&buf, &bufSize, fp);
+	if (len < 0) {
+		if (ferror(fp))
+			failErrno("getline");
+		return false;
+	}
+	if (len > 0 && buf[len - 1] == '\n')
+		buf[--len] = '\0';
+	return true;
+}
+
+/* log(n!), from a table for small n */
+static double lnfact(unsigned int n) {
+	static const unsigned int tableSize = 4096;
+	static const std::vector<double> table = [] {
+		std::vector<double> t(tableSize);
+		for (unsigned int i = 0; i < tableSize; i++)
+			t[i] = gsl_sf_lnfact(i);
+		return t;
+	}();
+	return (n < tableSize) ? table[n] : gsl_sf_lnfact(n);
+}
+
+/*
+ * Read a bank written by bin/estimate --slots: "# of Slots", "Period", and
+ * for every slot "Slot : j" followed by a model as written by bin/estimate
+ * (dense or sparse theta).  The model of a slot without data has no
+ * components and no segments.
+ */
+void ModelBank::loadBank(FILE *fp) {
+	char *buf = NULL;
+	size_t bufSize = 0;
+	struct Row {
+		size_t s, slot, offset;
+	};
+	std::vector<Row> rows;
+
+	_ids.clear();
+	_lambda.clear();
+	_logLambda.clear();
+	_logTheta.clear();
+	if (!nextLine(fp, buf, bufSize)
+			|| sscanf(buf, "# of Slots : %zu", &_nSlots) != 1 || _nSlots == 0)
+		badBank(buf != NULL ? buf : "");
+	if (!nextLine(fp, buf, bufSize)
+			|| sscanf(buf, "Period : %" SCNd64, &_period) != 1 || _period <= 0
+			|| _period % (int64_t) _nSlots != 0)
+		badBank(buf);
+	_slotWidth = _period / (int64_t) _nSlots;
+	_first.assign(1, 0);
+
+	bool more = nextLine(fp, buf, bufSize);
+	std::vector<double> theta;
+	for (size_t j = 0; j < _nSlots; j++) {
+		size_t slot, K, dim;
+		if (!more || sscanf(buf, "Slot : %zu", &slot) != 1 || slot != j)
+			badBank(more ? buf : "");
+		if (!nextLine(fp, buf, bufSize)
+				|| sscanf(buf, "# of Mixture : %zu", &K) != 1)
+			badBank(buf);
+		if (!nextLine(fp, buf, bufSize)
+				|| sscanf(buf, "Dimension : %zu", &dim) != 1 || dim != 1)
+			badBank(buf);
+		if (!nextLine(fp, buf, bufSize) || strcmp(buf, "lambda") != 0)
+			badBank(buf);
+		for (size_t k = 0; k < K; k++) {
+			double lambda;
+			if (!nextLine(fp, buf, bufSize) || sscanf(buf, "%lf", &lambda) != 1
+					|| !(lambda > 0.0))
+				badBank(buf);
+			_lambda.push_back(lambda);
+			_logLambda.push_back(std::log(lambda));
+		}
+		_first.push_back(_lambda.size());
+		if (!nextLine(fp, buf, bufSize)) /* blank line */
+			badBank("");
+		if (!nextLine(fp, buf, bufSize) || strncmp(buf, "id,Ns,", 6) != 0)
+			badBank(buf);
+		bool sparse = (strncmp(buf, "id,Ns,k:theta", 13) == 0);
+
+		/* one segment per line until the next slot */
+		theta.resize(K);
+		while ((more = nextLine(fp, buf, bufSize))
+				&& strncmp(buf, "Slot : ", 7) != 0) {
+			std::string line(buf);
+			char *p = buf;
+			char *id = strsep(&p, ",");
+			if (p == NULL || strsep(&p, ",") == NULL) /* Ns */
+				badBank(line);
+			std::fill(theta.begin(), theta.end(), 0.0);
+			for (size_t k = 0; p != NULL; k++) {
+				char *token = strsep(&p, ",");
+				if (sparse) {
+					char *end;
+					unsigned long c = strtoul(token, &end, 10);
+					if (*end != ':' || c < 1 || c > K)
+						badBank(line);
+					theta[c - 1] = atof(end + 1);
+				} else if (k < K) {
+					theta[k] = atof(token);
+				} else {
+					badBank(line);
+				}
+			}
+			Row r = { _ids.insert(id, strlen(id)), j, _logTheta.size() };
+			rows.push_back(r);
+			for (size_t k = 0; k < K; k++) {
+				_logTheta.push_back((theta[k] > 0.0) ? std::log(theta[k]) : -INFINITY);
+			}
+		}
+	}
+	if (more)
+		badBank(buf);
+	free(buf);
+
+	/* index the rows by segment; they are in slot order already */
+	std::stable_sort(rows.begin(), rows.end(), [](const Row& a, const Row& b) {
+		return a.s < b.s;
+	});
+	_rowFirst.assign(_ids.size() + 1, 0);
+	_rowSlot.resize(rows.size());
+	_rowTheta.resize(rows.size());
+	for (size_t i = 0; i < rows.size(); i++) {
+		++_rowFirst[rows[i].s + 1];
+		_rowSlot[i] = rows[i].slot;
+		_rowTheta[i] = rows[i].offset;
+	}
+	for (size_t s = 0; s < _ids.size(); s++)
+		_rowFirst[s + 1] += _rowFirst[s];
+}
+
+/* slot of timestamp t (the period rounded down also for negative t) */
+size_t ModelBank::slotOf(int64_t t) const {
+	int64_t r = t % _period;
+	return (size_t) (((r < 0) ? r + _period : r) / _slotWidth);
+}
+
+/* log theta of segment s in slot, or NULL if it is not in that model */
+const double* ModelBank::_findPrior(size_t s, size_t slot) {
+	if (s == SegmentIdTable::npos)
+		return NULL;
+	auto begin = _rowSlot.begin() + _rowFirst[s];
+	auto end = _rowSlot.begin() + _rowFirst[s + 1];
+	auto it = std::lower_bound(begin, end, slot);
+	if (it == end || *it != slot)
+		return NULL;
+	return &_logTheta[_rowTheta[it - _rowSlot.begin()]];
+}
+
+/*
+ * Score a batch of n records: record i, the value x[i] of segment ids[i]
+ * (lens[i] bytes) at time[i], is routed to the model of its slot and gets
+ * the log-likelihood under it, with the theta of the segment there (uniform
+ * if the segment is not in that model), and the most likely component in
+ * state[i], numbered from 1 as in the bank file; a record of a slot without
+ * components gets NaN and state 0.  The log pmfs of all records and
+ * components of the batch, whatever their slot, are computed in one loop
+ * over flat arrays.
+ */
+void ModelBank::score(size_t n, const char * const *ids, const size_t *lens,
+		const int *x, const int64_t *time, double *loglik, size_t *state) {
+	/* route: the components of every record, one pair each */
+	_pairFirst.resize(n + 1);
+	_prior.resize(n);
+	_component.clear();
+	_value.clear();
+	_pairFirst[0] = 0;
+	for (size_t i = 0; i < n; i++) {
+		size_t slot = slotOf(time[i]);
+		_prior[i] = _findPrior(_ids.find(ids[i], lens[i]), slot);
+		for (size_t c = _first[slot]; c < _first[slot + 1]; c++) {
+			_component.push_back(c);
+			_value.push_back((double) x[i]);
+		}
+		_pairFirst[i + 1] = _component.size();
+	}
+
+	/* log pmf of every pair but the log factorial, which is per record */
+	size_t nPairs = _component.size();
+	_logPmf.resize(nPairs);
+	const size_t *c = _component.data();
+	const double *v = _value.data();
+	const double *lambda = _lambda.data(), *logLambda = _logLambda.data();
+	double *lp = _logPmf.data();
+	for (size_t j = 0; j < nPairs; j++)
+		lp[j] = v[j] * logLambda[c[j]] - lambda[c[j]];
+
+	/* mix per record (log domain) */
+	for (size_t i = 0; i < n; i++) {
+		double *g = lp + _pairFirst[i];
+		size_t K = _pairFirst[i + 1] - _pairFirst[i];
+		if (K == 0) {	/* no model for the slot */
+			state[i] = 0;
+			loglik[i] = NAN;
+			continue;
+		}
+		const double *prior = _prior[i];
+		double logUniform = -std::log((double) K);
+		double max = -INFINITY;
+		size_t best = 0;
+		for (size_t k = 0; k < K; k++) {
+			g[k] += (prior != NULL) ? prior[k] : logUniform;
+			if (g[k] > max) {
+				max = g[k];
+				best = k;
+			}
+		}
+		state[i] = best + 1;
+		if (max == -INFINITY) {
+			loglik[i] = -INFINITY;
+			continue;
+		}
+		double sum = 0.0;
+		for (size_t k = 0; k < K; k++)
+			sum += std::exp(g[k] - max);
+		loglik[i] = max + std::log(sum) - lnfact((unsigned int) x[i]);
+	}
+}
@@ -0,0 +1,77 @@
+/*
+ * ModelBank.h
+ *
+ * Copyright (C) 2016  Akira Kinoshita <kinoshita@nii.ac.jp>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef SRC_CLASS_MODELBANK_H_
+#define SRC_CLASS_MODELBANK_H_
+
+#include <cstdio>
+#include <cstdint>
+#include <vector>
+#include "SegmentIdTable.h"
+
+/*
+ * Trained Poisson mixtures, one per slot of a period (e.g. hour of week),
+ * written by bin/estimate --slots.
+ *
+ * All models share flat arrays: the lambdas of slot j are _lambda[_first[j]
+ * .. _first[j + 1]), and the log theta rows of all slots are packed in
+ * _logTheta, found through a per-segment index sorted by slot.  A record at
+ * time t belongs to slot (t mod period) / (period / number of slots).
+ */
+class ModelBank {
+private:
+	/* private member variables */
+	size_t _nSlots;
+	int64_t _period, _slotWidth;
+	std::vector<size_t> _first; /* first component of each slot, + total */
+	std::vector<double> _lambda; /* sorted as in the bank file per slot */
+	std::vector<double> _logLambda;
+
+	SegmentIdTable _ids; /* segments of any slot */
+	std::vector<size_t> _rowFirst; /* first row of each segment, + total */
+	std::vector<size_t> _rowSlot; /* rows by segment, then by slot */
+	std::vector<size_t> _rowTheta; /* offset of the row in _logTheta */
+	std::vector<double> _logTheta;
+
+	/* scratch of score(), one entry per record or per component of it */
+	std::vector<size_t> _pairFirst, _component;
+	std::vector<double> _value, _logPmf;
+	std::vector<const double*> _prior;
+
+	/* private member functions */
+	const double* _findPrior(size_t s, size_t slot);
+
+public:
+	/* constructor & destructor */
+	ModelBank();
+	virtual ~ModelBank();
+
+	/* getter */
+	size_t slots(void) const;
+	size_t size(void) const;
+	size_t K(size_t slot) const;
+
+	/* public member functions */
+	void loadBank(FILE *fp);
+	size_t slotOf(int64_t t) const;
+	void score(size_t n, const char * const *ids, const size_t *lens,
+			const int *x, const int64_t *time, double *loglik, size_t *state);
+};
+
+#endif /* SRC_CLASS_MODELBANK_H_ */
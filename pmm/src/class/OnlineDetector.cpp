@@ -0,0 +1,210 @@
+/*
+ * OnlineDetector.cpp
+ *
+ * Copyright (C) 2016  Akira Kinoshita <kinoshita@nii.ac.jp>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "OnlineDetector.h"
+#include "PmmError.h"
+
+#include <iostream>
+#include <cmath>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+#include <algorithm>
+
+OnlineDetector::OnlineDetector(size_t window, double threshold,
+		double release, double priorFloor) :
+		_K(0), _window(window), _threshold(threshold), _release(release),
+		_priorFloor(priorFloor) {
+}
+
+OnlineDetector::~OnlineDetector() {
+}
+
+size_t OnlineDetector::size(void) const {
+	return _ids.size();
+}
+
+size_t OnlineDetector::K(void) const {
+	return _K;
+}
+
+static void badModel(const std::string& line) {
+	fail("invalid model file near: ", line);
+}
+
+/*
+ * Read a model written by bin/estimate (dense or sparse theta).  Segments of
+ * the model get their trained theta as the prior; the lowest lambda is the
+ * incident state unless setIncidentComponents() says otherwise.
+ */
+void OnlineDetector::loadModel(FILE *fp) {
+	char *buf = NULL;
+	size_t bufSize = 0;
+	ssize_t len;
+	size_t dim = 0;
+	bool sparse = false;
+
+	/* header */
+	if ((len = getline(&buf, &bufSize, fp)) < 0
+			|| sscanf(buf, "# of Mixture : %lu", &_K) != 1 || _K == 0)
+		badModel(len < 0 ? "" : buf);
+	if ((len = getline(&buf, &bufSize, fp)) < 0
+			|| sscanf(buf, "Dimension : %lu", &dim) != 1 || dim != 1)
+		badModel(len < 0 ? "" : buf);
+	if ((len = getline(&buf, &bufSize, fp)) < 0 || strncmp(buf, "lambda", 6) != 0)
+		badModel(len < 0 ? "" : buf);
+	_lambda.resize(_K);
+	_logLambda.resize(_K);
+	for (size_t k = 0; k < _K; k++) {
+		if ((len = getline(&buf, &bufSize, fp)) < 0
+				|| sscanf(buf, "%lf", &_lambda[k]) != 1 || !(_lambda[k] > 0.0))
+			badModel(len < 0 ? "" : buf);
+		_logLambda[k] = std::log(_lambda[k]);
+	}
+	_incident.assign(_K, 0);
+	_incident[0] = 1;
+	if ((len = getline(&buf, &bufSize, fp)) < 0) /* blank line */
+		badModel("");
+	if ((len = getline(&buf, &bufSize, fp)) < 0 || strncmp(buf, "id,Ns,", 6) != 0)
+		badModel(len < 0 ? "" : buf);
+	sparse = (strncmp(buf, "id,Ns,k:theta", 13) == 0);
+
+	/* one segment per line */
+	std::vector<double> theta(_K);
+	while ((len = getline(&buf, &bufSize, fp)) > 0) {
+		if (buf[len - 1] == '\n')
+			buf[--len] = '\0';
+		std::string line(buf);
+		char *p = buf;
+		char *id = strsep(&p, ",");
+		if (p == NULL || strsep(&p, ",") == NULL) /* Ns */
+			badModel(line);
+		size_t s = _addSegment(id, strlen(id));
+		std::fill(theta.begin(), theta.end(), 0.0);
+		for (size_t k = 0; p != NULL; k++) {
+			char *token = strsep(&p, ",");
+			if (sparse) {
+				char *end;
+				unsigned long c = strtoul(token, &end, 10);
+				if (*end != ':' || c < 1 || c > _K)
+					badModel(line);
+				theta[c - 1] = atof(end + 1);
+			} else if (k < _K) {
+				theta[k] = atof(token);
+			} else {
+				badModel(line);
+			}
+		}
+		for (size_t k = 0; k < _K; k++) {
+			_prior[s * _K + k] = std::log(std::max(theta[k], _priorFloor));
+		}
+	}
+	free(buf);
+	if (ferror(fp))
+		failErrno("getline");
+}
+
+/* components are numbered from 1 in the order of the model file */
+void OnlineDetector::setIncidentComponents(const std::vector<size_t>& ks) {
+	_incident.assign(_K, 0);
+	for (size_t i = 0; i < ks.size(); i++) {
+		if (ks[i] < 1 || ks[i] > _K) {
+			fail("no such component: ", ks[i]);
+		}
+		_incident[ks[i] - 1] = 1;
+	}
+}
+
+/* register a segment (uniform prior if it is new) and return its index */
+size_t OnlineDetector::_addSegment(const char *id, size_t len) {
+	size_t s = _ids.insert(id, len);
+	if (s < _head.size())
+		return s;
+	_prior.resize((s + 1) * _K, -std::log((double) _K));
+	_gamma.resize((s + 1) * _window * _K, 0.0);
+	_sum.resize((s + 1) * _K, 0.0);
+	_head.push_back(0);
+	_count.push_back(0);
+	_state.push_back(0);
+	return s;
+}
+
+/*
+ * Add record x of segment id.  posterior is set to the current theta of the
+ * incident components; the return value is the new state (1: incident,
+ * 0: normal) if it has just changed, or -1 otherwise.
+ */
+int OnlineDetector::observe(const char *id, size_t len, int x, double& posterior) {
+	size_t s = _addSegment(id, len);
+	const double *logPrior = &_prior[s * _K];
+	double *sum = &_sum[s * _K];
+	double *ring = &_gamma[s * _window * _K];
+	double *g = ring + _head[s] * _K;
+	size_t k;
+
+	/* evict the oldest record */
+	if (_count[s] == _window) {
+		for (k = 0; k < _K; k++) {
+			sum[k] -= g[k];
+		}
+	} else {
+		++_count[s];
+	}
+
+	/* responsibilities of x with fixed lambdas (log domain) */
+	double max = -INFINITY;
+	for (k = 0; k < _K; k++) {
+		g[k] = logPrior[k] + x * _logLambda[k] - _lambda[k];
+		if (g[k] > max)
+			max = g[k];
+	}
+	double denom = 0.0;
+	for (k = 0; k < _K; k++) {
+		g[k] = std::exp(g[k] - max);
+		denom += g[k];
+	}
+	for (k = 0; k < _K; k++) {
+		g[k] /= denom;
+		sum[k] += g[k];
+	}
+
+	/* recompute the sum once per round of the ring to stop drift */
+	if (++_head[s] == _window) {
+		_head[s] = 0;
+		for (k = 0; k < _K; k++) {
+			sum[k] = 0.0;
+			for (size_t i = 0; i < _count[s]; i++) {
+				sum[k] += ring[i * _K + k];
+			}
+		}
+	}
+
+	posterior = 0.0;
+	for (k = 0; k < _K; k++) {
+		if (_incident[k])
+			posterior += sum[k];
+	}
+	posterior /= (double) _count[s];
+
+	char state = _state[s] ? (posterior >= _release) : (posterior >= _threshold);
+	if (state == _state[s])
+		return -1;
+	_state[s] = state;
+	return state;
+}
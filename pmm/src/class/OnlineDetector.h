@@ -0,0 +1,79 @@
+/*
+ * OnlineDetector.h
+ *
+ * Copyright (C) 2016  Akira Kinoshita <kinoshita@nii.ac.jp>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef SRC_CLASS_ONLINEDETECTOR_H_
+#define SRC_CLASS_ONLINEDETECTOR_H_
+
+#include <cstdio>
+#include <vector>
+#include "SegmentIdTable.h"
+
+/*
+ * Incident detection on a stream of records with a trained Poisson mixture.
+ *
+ * The lambdas of the model stay fixed.  For each segment, the last _window
+ * records are kept in a preallocated ring together with their
+ * responsibilities (the trained theta of the segment serves as the prior),
+ * and the current theta of the segment is the mean responsibility over the
+ * ring.  A segment enters the incident state when the current theta of the
+ * incident components adds up to at least _threshold, and leaves it when
+ * the sum drops below _release.  Trained thetas below _priorFloor (e.g.
+ * pruned ones of a sparse model) are raised to it, so that every component
+ * stays reachable.
+ */
+class OnlineDetector {
+private:
+	/* private member variables */
+	size_t _K;
+	const size_t _window;
+	const double _threshold;
+	const double _release;
+	const double _priorFloor;
+	std::vector<double> _lambda; /* sorted as in the model file */
+	std::vector<double> _logLambda;
+	std::vector<char> _incident; /* component k is an incident state */
+
+	SegmentIdTable _ids;
+	std::vector<double> _prior; /* S x K log of the trained theta */
+	std::vector<double> _gamma; /* S x window x K responsibilities */
+	std::vector<double> _sum; /* S x K sum of _gamma over the ring */
+	std::vector<size_t> _head; /* next slot of the ring */
+	std::vector<size_t> _count; /* records in the ring */
+	std::vector<char> _state; /* 1: incident */
+
+	/* private member functions */
+	size_t _addSegment(const char *id, size_t len);
+
+public:
+	/* constructor & destructor */
+	OnlineDetector(size_t window, double threshold, double release,
+			double priorFloor);
+	virtual ~OnlineDetector();
+
+	/* getter */
+	size_t size(void) const;
+	size_t K(void) const;
+
+	/* public member functions */
+	void loadModel(FILE *fp);
+	void setIncidentComponents(const std::vector<size_t>& ks);
+	int observe(const char *id, size_t len, int x, double& posterior);
+};
+
+#endif /* SRC_CLASS_ONLINEDETECTOR_H_ */
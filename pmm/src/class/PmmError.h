@@ -0,0 +1,76 @@
+/*
+ * PmmError.h
+ *
+ * Copyright (C) 2016  Akira Kinoshita <kinoshita@nii.ac.jp>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef SRC_CLASS_PMMERROR_H_
+#define SRC_CLASS_PMMERROR_H_
+
+#include <stdexcept>
+#include <exception>
+#include <sstream>
+#include <string>
+#include <mutex>
+
+/*
+ * Error raised by the classes instead of exiting: the programs print it and
+ * exit, and libpmm turns it into an error code.
+ */
+class PmmError: public std::runtime_error {
+public:
+	/* constructor & destructor */
+	PmmError(const std::string& what);
+};
+
+/* throw a PmmError whose message is the concatenation of args */
+template<class ... Args>
+[[noreturn]] void fail(const Args&... args) {
+	std::ostringstream os;
+	int expand[] = { 0, ((void) (os << args), 0)... };
+	(void) expand;
+	throw PmmError(os.str());
+}
+
+/* throw a PmmError with the message perror(what) would print */
+[[noreturn]] void failErrno(const char *what);
+
+/*
+ * Exceptions must not leave an OpenMP parallel region or a thread.  Run the
+ * body of each iteration through run(), and call rethrow() afterwards to
+ * raise the first error, if any.
+ */
+class ParallelErrors {
+private:
+	/* private member variables */
+	std::exception_ptr _first;
+	std::mutex _mutex;
+
+public:
+	/* public member functions */
+	template<class F> void run(F f) {
+		try {
+			f();
+		} catch (...) {
+			std::lock_guard<std::mutex> lock(_mutex);
+			if (!_first)
+				_first = std::current_exception();
+		}
+	}
+	void rethrow(void);
+};
+
+#endif /* SRC_CLASS_PMMERROR_H_ */
@@ -18,16 +18,19 @@
  */
 
 #include "PoissonMixtureModel.h"
-#include "../lib/util.h"
+#include "PmmError.h"
+#include "../lib/bitpack.h"
 
 #include <iostream>
 #include <cstdio>
 #include <cstring>
 #include <random>
+#include <algorithm>
 #include <gsl/gsl_randist.h>
+#include <gsl/gsl_sf_gamma.h>
 
 PoissonMixtureModel::PoissonMixtureModel(size_t k, size_t d, bool doSrand) :
-		TopicModel(k, d, sizeof(int), doSrand) {
+		TopicModel(k, d, sizeof(int), doSrand), _kernel(POISSON_KERNEL_GSL) {
 	_distParams.resize(_K);
 	for (size_t k = 0; k < _K; ++k) {
 		_distParams[k].resize(_D);
@@ -54,33 +57,68 @@ PoissonMixtureModel::PoissonMixtureModel(size_t k, size_t d) :
 		PoissonMixtureModel(k, d, true) {
 }
 
+void PoissonMixtureModel::setKernel(PoissonKernel kernel) {
+	_kernel = kernel;
+	_refreshKernel();
+}
+
+/* recompute what the kernel caches; call after every change of lambda */
+void PoissonMixtureModel::_refreshKernel(void) {
+	if (_kernel != POISSON_KERNEL_TABLE)
+		return;
+	_logDistParams.resize(_K);
+	for (size_t k = 0; k < _K; k++) {
+		_logDistParams[k].resize(_D);
+		for (size_t d = 0; d < _D; ++d) {
+			double lambda = _distParams[k][d];
+			_logDistParams[k][d] = (lambda > 0.0) ? std::log(lambda) : 0.0;
+		}
+	}
+}
+
 bool PoissonMixtureModel::_readDataFileLine(
-		std::unordered_map<std::string, SegmentObservingVector<int>*>& hashtable,
-		char *buf, bool forceadd) {
+		std::vector<SegmentObservingVector<int>*>& table,
+		SegmentIdTable& ids, char *buf, bool forceadd) {
 	char *p = buf;
 	const char *delim = ",";
 	char *token;
 
 	token = strsep(&p, delim);
 	if (token == NULL) {
-		std::cerr << "readDataFile: cannot read id" << std::endl;
-		exit(1);
+		fail("readDataFile: cannot read id");
 	}
-	std::string id(token);
+	char *id = token;
+	/* strsep() has replaced the ',' just before p with '\0' */
+	size_t len = (p != NULL) ? (size_t) (p - token - 1) : strlen(token);
 
 	int dataPoint[_D];
 	for (size_t d = 0; d < _D; d++) {
 		token = strsep(&p, delim);
 		if (token == NULL) {
-			std::cerr << "readDataFile: cannot read value" << std::endl;
-			exit(1);
+			fail("readDataFile: cannot read value");
 		}
 		dataPoint[d] = atoi(token);
 	}
 
+	/* optional timestamp (seconds), needed for time buckets and ranges */
+	int64_t time = 0;
+	bool hasTime = false;
+	token = strsep(&p, delim);
+	if (token != NULL) {
+		char *end;
+		time = strtoll(token, &end, 10);
+		hasTime = (end != token);
+	}
+	if (!hasTime && (_bucketWidth > 0 || _hasTimeRange())) {
+		fail("readDataFile: cannot read timestamp");
+	}
+	if (hasTime && !_inTimeRange(time))
+		return false;
+
 	bool ret = _isValid(dataPoint);
 	if (ret) {
-		_addData(hashtable, id, dataPoint, forceadd);
+		_addData(table, ids, id, len, dataPoint, hasTime ? &time : NULL,
+				forceadd);
 	}
 	return ret;
 }
@@ -88,36 +126,35 @@ bool PoissonMixtureModel::_readDataFileLine(
 bool PoissonMixtureModel::_loadSegmentDataFromDump(FILE *fp) {
 	size_t nData, nId;
 	if (fread(&nData, sizeof(size_t), 1, fp) != 1)
-		die("fread");
+		failErrno("fread");
 	if (fread(&nId, sizeof(size_t), 1, fp) != 1)
-		die("fread");
+		failErrno("fread");
+	std::vector<char> id(nId + 1, '\0');
+	if (fread(id.data(), sizeof(char), nId, fp) != nId)
+		failErrno("fread");
+	std::vector<RecordBlock> blocks;
+	_readBlockIndex(fp, nData, blocks);
+	size_t first, last;
+	nData = _selectBlocks(blocks, first, last);
+
 	bool ret = (nData >= _nThres);
 	if (ret) {
-		char id[nId + 1];
-		memset(id, 0, sizeof(char) * (nId + 1));
-		if (fread(id, sizeof(char), nId, fp) != nId)
-			die("fread");
-
 		SegmentObservingVector<int> *seg = new SegmentObservingVector<int>(
-				std::string(id));
+				_ids.insert(id.data(), nId));
+		std::vector<int> data(nData * _D);
+		_readBlocks(fp, blocks, first, last, data.data());
 		seg->data.clear();
+		seg->data.reserve(nData);
 		for (size_t j = 0; j < nData; j++) {
-			int data[_D];
-			if (fread(&data, _valueSize, _D, fp) != _D)
-				die("fread");
-			std::valarray<int> v(data, _D);
+			std::valarray<int> v(&data[j * _D], _D);
 			ObservedValue<std::valarray<int>> ov(v);
 			seg->data.push_back(ov);
 		}
 
-		seg->initLatentParams(_K);
+		_initLatentParams(seg);
 		_segments.push_back(seg);
 	} else { /* skip */
-		if (fseek(fp, (long) nId, SEEK_CUR) < 0)
-			die("fseek");
-		long skip = _valueSize * _D * nData;
-		if (fseek(fp, skip, SEEK_CUR) < 0)
-			die("fseek");
+		_skipBlocks(fp, blocks);
 	}
 	return ret;
 }
@@ -126,24 +163,40 @@ bool PoissonMixtureModel::_saveSegmentDataToDump(FILE *fp,
 		SegmentObservingVector<int>* seg) {
 	size_t n = seg->data.size();
 	if (fwrite(&n, sizeof(size_t), 1, fp) != 1)
-		die("fwrite");
-	size_t l = seg->getId().length();
+		failErrno("fwrite");
+	size_t l = _ids.length(seg->getId());
 	if (fwrite(&l, sizeof(size_t), 1, fp) != 1)
-		die("fwrite");
-	if (fwrite(seg->getId().c_str(), sizeof(char), l, fp) != l)
-		die("fwrite");
-	size_t nd = seg->data.size() * _D;
-	int data[nd];
+		failErrno("fwrite");
+	if (fwrite(_ids.str(seg->getId()), sizeof(char), l, fp) != l)
+		failErrno("fwrite");
+	std::vector<int> data(seg->data.size() * _D);
 	for (size_t n = 0; n < seg->data.size(); ++n) {
 		for (size_t d = 0; d < _D; ++d) {
 			data[n * _D + d] = seg->data[n].value[d];
 		}
 	}
-	if (fwrite(data, sizeof(int), nd, fp) != nd)
-		die("fwrite");
+	_writeBlocks(fp, data.data(), seg->time.empty() ? NULL : seg->time.data(),
+			seg->data.size());
 	return true;
 }
 
+void PoissonMixtureModel::_encodeRecords(const int *x, size_t nData,
+		std::vector<unsigned char>& out) {
+	if (!(_dumpFlags & DUMP_PACKED)) {
+		TopicModel::_encodeRecords(x, nData, out);
+		return;
+	}
+	out.resize(bitpackBound(nData * _D));
+	out.resize(bitpack(x, nData * _D, out.data()));
+}
+
+bool PoissonMixtureModel::_decodeRecords(const unsigned char *in,
+		size_t bytes, size_t nData, int *x) {
+	if (!(_dumpFlags & DUMP_PACKED))
+		return TopicModel::_decodeRecords(in, bytes, nData, x);
+	return bitunpack(in, bytes, nData * _D, x) == 0;
+}
+
 bool PoissonMixtureModel::_isValid(int *dataPoint) {
 	for (size_t d = 0; d < _D; d++) {
 		if (dataPoint[d] < 0)
@@ -153,22 +206,25 @@ bool PoissonMixtureModel::_isValid(int *dataPoint) {
 }
 
 void PoissonMixtureModel::_addData(
-		std::unordered_map<std::string, SegmentObservingVector<int>*>& hashtable,
-		std::string id, int *dataPoint, bool forceadd) {
-	SegmentObservingVector<int> *seg = _searchSegment(hashtable, id,
+		std::vector<SegmentObservingVector<int>*>& table, SegmentIdTable& ids,
+		const char *id, size_t len, int *dataPoint, const int64_t *time,
+		bool forceadd) {
+	SegmentObservingVector<int> *seg = _searchSegment(table, ids, id, len,
 			forceadd);
 	if (seg != NULL) {
 		std::valarray<int> dp(dataPoint, _D);
 		ObservedValue<std::valarray<int>> d(dp);
 		seg->addData(d);
+		if (_bucketWidth > 0)
+			seg->time.push_back(*time);
 	}
 }
 
 void PoissonMixtureModel::validateDataset(void) {
 }
 
-int PoissonMixtureModel::_compareDistParams(std::valarray<double> dp1,
-		std::valarray<double> dp2) {
+int PoissonMixtureModel::_compareDistParams(const std::valarray<double>& dp1,
+		const std::valarray<double>& dp2) {
 	for (size_t d = 0; d < _D; ++d) {
 		if (dp1[d] < dp2[d]) {
 			return -1;
@@ -181,24 +237,12 @@ int PoissonMixtureModel::_compareDistParams(std::valarray<double> dp1,
 
 void PoissonMixtureModel::_dumpTopicParamsAndSegments(void) {
 	/* sort by parameter */
-	size_t order[_K];
-	order[0] = 0;
-	for (size_t k = 1; k < _K; k++) {
-		bool flag = false;
-		for (size_t l = 0; l < k; l++) {
-			if (_compareDistParams(_distParams[k], _distParams[order[l]]) < 0) {
-				for (size_t m = k; m > l; m--) {
-					order[m] = order[m - 1];
-				}
-				order[l] = k;
-				flag = true;
-				break;
-			}
-		}
-		if (!flag) {
-			order[k] = k;
-		}
-	}
+	std::vector<size_t> order(_K);
+	for (size_t k = 0; k < _K; k++)
+		order[k] = k;
+	std::stable_sort(order.begin(), order.end(), [this](size_t i, size_t j) {
+		return _compareDistParams(_distParams[i], _distParams[j]) < 0;
+	});
 
 	printf("lambda\n");
 	for (size_t k = 0; k < _K; ++k) {
@@ -212,57 +256,106 @@ void PoissonMixtureModel::_dumpTopicParamsAndSegments(void) {
 
 	/* mixing coefficient for each segment */
 	/* Ns is the data size */
-	printf("id,Ns,theta1,theta2,...\n");
-	for (size_t s = 0; s < _segments.size(); s++) {
-		SegmentObservingVector<int> *seg = _segments[s];
-		printf("%s,%lu", seg->getId().c_str(), seg->data.size());
-		for (size_t k = 0; k < _K; k++) {
-			printf(",%e", seg->theta[order[k]]);
+	_writeSegments(order.data());
+}
+
+void PoissonMixtureModel::_Mstep(void) {
+	std::valarray<double> stats(0.0, _numberOfSufficientStatistics());
+	_sufficientStatistics(&stats[0]);
+	_updateDistParams(&stats[0]);
+}
+
+size_t PoissonMixtureModel::_bytesPerRecord(void) {
+	return _valueSize * _D;
+}
+
+/*
+ * For each component k, the sufficient statistics are
+ * stats[k * (D + 1)] = sum of gamma, and
+ * stats[k * (D + 1) + 1 + d] = sum of gamma * x[d].
+ */
+size_t PoissonMixtureModel::_numberOfSufficientStatistics(void) {
+	return _K * (_D + 1);
+}
+
+void PoissonMixtureModel::_accumulateSufficientStatistics(const int *x,
+		const double *gamma, double *stats) {
+	for (size_t k = 0; k < _K; ++k) {
+		double *st = stats + k * (_D + 1);
+		st[0] += gamma[k];
+		for (size_t d = 0; d < _D; ++d) {
+			st[1 + d] += gamma[k] * (double) x[d];
 		}
-		printf("\n");
 	}
 }
 
-void PoissonMixtureModel::_Mstep(void) {
-	size_t s, n, k, d;
+/*
+ * lambda[k][d] = sum of gamma * x[d] / sum of gamma, for each dimension d.
+ * A component without any responsibility keeps its lambda.
+ */
+void PoissonMixtureModel::_updateDistParams(const double *stats) {
+	for (size_t k = 0; k < _K; k++) {
+		const double *st = stats + k * (_D + 1);
+		double denom = st[0];
+		if (denom == 0.0)
+			continue; /* pruned from every segment; keep lambda */
+		for (size_t d = 0; d < _D; ++d) {
+			double num = _finitePositiveValue(st[1 + d]);
+			_distParams[k][d] = num / denom;
+		}
+	}
+	_refreshKernel();
+}
+
+size_t PoissonMixtureModel::_numberOfDistParams(void) {
+	return _K * _D;
+}
 
-	/* buffers */
-	std::vector<std::valarray<double>> gam_l(_K,
-			std::valarray<double>(0.0, _segments.size()));
-	std::vector<std::vector<std::valarray<double>>>gam_x(_K,
-			std::vector<std::valarray<double>>(_D,
-					std::valarray<double>(0.0, _segments.size())));
+void PoissonMixtureModel::_getDistParams(double *params) {
+	for (size_t k = 0; k < _K; k++) {
+		for (size_t d = 0; d < _D; ++d) {
+			params[k * _D + d] = _distParams[k][d];
+		}
+	}
+}
 
-#ifdef _OPENMP
-#pragma omp parallel for private(n, k, d) schedule(dynamic)
-#endif
-	for (s = 0; s < _segments.size(); ++s) {
-		SegmentObservingVector<int> *seg = _segments[s];
-		for (k = 0; k < _K; ++k) {
-			double gamma_total = 0.0;
-			std::valarray<double> gamma_x_total(0.0, _D);
-			for (n = 0; n < seg->data.size(); ++n) {
-				gamma_total += seg->data[n].gamma[k];
-				for (d = 0; d < _D; ++d) {
-					gamma_x_total[d] += seg->data[n].gamma[k]
-							* (double) seg->data[n].value[d];
-				}
-			}
-			seg->theta[k] = gamma_total / (double) seg->data.size();
-			for (d = 0; d < _D; ++d) {
-				gam_x[k][d][s] = gamma_x_total[d];
-			}
-			gam_l[k][s] = gamma_total;
+void PoissonMixtureModel::_setDistParams(const double *params) {
+	for (size_t k = 0; k < _K; k++) {
+		for (size_t d = 0; d < _D; ++d) {
+			_distParams[k][d] = params[k * _D + d];
 		}
 	}
+	_refreshKernel();
+}
 
-	for (k = 0; k < _K; k++) {
-		double denom = gam_l[k].sum();
-		for (d = 0; d < _D; ++d) {
-			double num = _finitePositiveValue(gam_x[k][d].sum());
-			_distParams[k] = num / denom;
+/* lambda must be positive */
+void PoissonMixtureModel::_initDistParamsFromCenters(const double *centers) {
+	for (size_t k = 0; k < _K; k++) {
+		for (size_t d = 0; d < _D; ++d) {
+			_distParams[k][d] = std::max(centers[k * _D + d], 0.1);
+		}
+	}
+	_refreshKernel();
+}
+
+/*
+ * Largest change of a log pdf from the lambdas from to those to, over all
+ * components and the values x with lo <= x <= hi.  The change is
+ * x log(to / from) - (to - from) per dimension, linear in x.
+ */
+double PoissonMixtureModel::_logPdfChange(const double *from, const double *to,
+		const double *lo, const double *hi) {
+	double change = 0.0;
+	for (size_t k = 0; k < _K; k++) {
+		double c = 0.0;
+		for (size_t d = 0; d < _D; ++d) {
+			size_t j = k * _D + d;
+			double a = std::log(to[j] / from[j]), b = to[j] - from[j];
+			c += std::max(std::fabs(lo[d] * a - b), std::fabs(hi[d] * a - b));
 		}
+		change = std::max(change, c);
 	}
+	return change;
 }
 
 double PoissonMixtureModel::_numberOfModelParameters(void) {
@@ -270,10 +363,42 @@ double PoissonMixtureModel::_numberOfModelParameters(void) {
 }
 
 double PoissonMixtureModel::_pdf(size_t s, size_t n, size_t k) {
-	SegmentObservingVector<int> *seg = _segments[s];
+	return _pdfOfRecord(&_segments[s]->data[n].value[0], k);
+}
+
+/*
+ * The same terms as gsl_ran_poisson_pdf, log(lambda) * x - lnfact(x) - lambda,
+ * but log(lambda) is computed once per M-step and lnfact(x) of small counts
+ * comes from a table, and the per-value pdfs are never materialized.
+ */
+double PoissonMixtureModel::_pdfOfRecordTable(const int *x, size_t k) {
+	static const size_t tableSize = 4096;
+	static const std::vector<double> lnfact = [] {
+		std::vector<double> t(tableSize);
+		for (size_t n = 0; n < tableSize; n++)
+			t[n] = gsl_sf_lnfact((unsigned int) n);
+		return t;
+	}();
+	double logp = 0.0;
+	for (size_t d = 0; d < _D; ++d) {
+		unsigned int n = (unsigned int) x[d];
+		if (_distParams[k][d] == 0.0) {
+			if (n != 0)
+				return 0.0;
+			continue;
+		}
+		double lf = (n < tableSize) ? lnfact[n] : gsl_sf_lnfact(n);
+		logp += _logDistParams[k][d] * n - lf - _distParams[k][d];
+	}
+	return std::exp(logp);
+}
+
+double PoissonMixtureModel::_pdfOfRecord(const int *x, size_t k) {
+	if (_kernel == POISSON_KERNEL_TABLE)
+		return _pdfOfRecordTable(x, k);
 	std::valarray<double> p(_D);
 	for (size_t d = 0; d < _D; ++d) {
-		p[d] = gsl_ran_poisson_pdf(seg->data[n].value[d], _distParams[k][d]);
+		p[d] = gsl_ran_poisson_pdf(x[d], _distParams[k][d]);
 	}
 	double ret = std::exp(std::log(p).sum());
 
@@ -300,7 +425,7 @@ double PoissonMixtureModel::_pdf(size_t s, size_t n, size_t k) {
 			default:
 			break;
 		}
-		die("gsl_ran_poisson_pdf");
+		failErrno("gsl_ran_poisson_pdf");
 		break;
 		case FP_ZERO:
 		case FP_SUBNORMAL:
@@ -22,20 +22,31 @@
 
 #include "TopicModel.h"
 #include <valarray>
-#include <unordered_map>
 #include "SegmentObservingVector.h"
 
+/* implementations of the Poisson pdf (bin/kernelcheck compares them) */
+enum PoissonKernel {
+	POISSON_KERNEL_GSL,	/* gsl_ran_poisson_pdf for every value (reference) */
+	POISSON_KERNEL_TABLE	/* cached log(lambda) and a log-factorial table */
+};
+
 class PoissonMixtureModel: public TopicModel<SegmentObservingVector<int>> {
 private:
 	/* private member variables */
 	std::vector<std::valarray<double>> _distParams;
+	PoissonKernel _kernel;
+	std::vector<std::valarray<double>> _logDistParams; /* for the table kernel */
 
 	/* private member functions */
 	bool _isValid(int *dataPoint);
-	void _addData(
-			std::unordered_map<std::string, SegmentObservingVector<int>*>& hashtable,
-			std::string id, int *dataPoint, bool forceadd);
-	int _compareDistParams(std::valarray<double> dp1, std::valarray<double> dp2);
+	void _addData(std::vector<SegmentObservingVector<int>*>& table,
+			SegmentIdTable& ids, const char *id, size_t len,
+			int *dataPoint, const int64_t *time,
+			bool forceadd);
+	int _compareDistParams(const std::valarray<double>& dp1,
+			const std::valarray<double>& dp2);
+	void _refreshKernel(void);
+	double _pdfOfRecordTable(const int *x, size_t k);
 
 protected:
 	/* protected member variables */
@@ -43,8 +54,8 @@ protected:
 
 	/* protected member interface implementation */
 	virtual bool _readDataFileLine(
-			std::unordered_map<std::string, SegmentObservingVector<int>*>& hashtable,
-			char *buf, bool forceadd);
+			std::vector<SegmentObservingVector<int>*>& table,
+			SegmentIdTable& ids, char *buf, bool forceadd);
 	virtual bool _loadSegmentDataFromDump(FILE *fp);
 	virtual bool _saveSegmentDataToDump(FILE *fp,
 			SegmentObservingVector<int>* seg);
@@ -52,6 +63,22 @@ protected:
 	virtual void _Mstep(void);
 	virtual double _numberOfModelParameters(void);
 	virtual double _pdf(size_t s, size_t n, size_t k);
+	virtual size_t _bytesPerRecord(void);
+	virtual size_t _numberOfSufficientStatistics(void);
+	virtual double _pdfOfRecord(const int *x, size_t k);
+	virtual void _accumulateSufficientStatistics(const int *x,
+			const double *gamma, double *stats);
+	virtual void _updateDistParams(const double *stats);
+	virtual size_t _numberOfDistParams(void);
+	virtual void _getDistParams(double *params);
+	virtual void _setDistParams(const double *params);
+	virtual void _initDistParamsFromCenters(const double *centers);
+	virtual double _logPdfChange(const double *from, const double *to,
+			const double *lo, const double *hi);
+	virtual void _encodeRecords(const int *x, size_t nData,
+			std::vector<unsigned char>& out);
+	virtual bool _decodeRecords(const unsigned char *in, size_t bytes,
+			size_t nData, int *x);
 
 public:
 	/* constructor & destructor */
@@ -59,6 +86,9 @@ public:
 	PoissonMixtureModel(size_t k, size_t d);
 	//virtual ~PoissonMixtureModel() = default;
 
+	/* getter & setter */
+	void setKernel(PoissonKernel kernel);
+
 	/* public member interface implementation */
 	virtual void validateDataset(void);
 };
@@ -19,7 +19,7 @@
 
 #include "Segment.h"
 
-Segment::Segment(std::string id) :
+Segment::Segment(size_t id) :
 		_id(id) {
 	theta.resize(0);
 }
@@ -27,11 +27,12 @@ Segment::Segment(std::string id) :
 Segment::~Segment() {
 }
 
-const std::string& Segment::getId(void) {
+size_t Segment::getId(void) {
 	return _id;
 }
 
 void Segment::initLatentParams(size_t k) {
 	theta.resize(k);
 	theta = 1.0 / (double) k;
+	active.clear();
 }
@@ -30,18 +30,19 @@
 class Segment {
 protected:
 	/* protected member variables */
-	const std::string _id;
+	const size_t _id; /* index in the model's SegmentIdTable */
 
 public:
 	/* constructor & destructor */
-	Segment(std::string id);
+	Segment(size_t id);
 	virtual ~Segment();
 
 	/* public member variables */
 	std::valarray<double> theta; /* mixing coefficient */
+	std::vector<size_t> active; /* components with non-zero theta; empty: all */
 
 	/* public member functions */
-	const std::string& getId(void);
+	size_t getId(void);
 	virtual void initLatentParams(size_t k);
 };
 
@@ -0,0 +1,130 @@
+/*
+ * SegmentIdTable.cpp
+ *
+ * Copyright (C) 2016  Akira Kinoshita <kinoshita@nii.ac.jp>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "SegmentIdTable.h"
+
+#include <cstring>
+
+const size_t SegmentIdTable::npos;
+
+SegmentIdTable::SegmentIdTable() {
+	clear();
+}
+
+SegmentIdTable::~SegmentIdTable() {
+}
+
+size_t SegmentIdTable::size(void) const {
+	return _hashes.size();
+}
+
+const char* SegmentIdTable::str(size_t i) const {
+	return &_arena[_offsets[i]];
+}
+
+size_t SegmentIdTable::length(size_t i) const {
+	return _offsets[i + 1] - _offsets[i] - 1;
+}
+
+/* FNV-1a */
+uint64_t SegmentIdTable::_hash(const char *id, size_t len) {
+	uint64_t h = 14695981039346656037ULL;
+	for (size_t i = 0; i < len; i++) {
+		h ^= (unsigned char) id[i];
+		h *= 1099511628211ULL;
+	}
+	return h;
+}
+
+/* slot holding the ID, or the empty slot where it would be inserted */
+size_t SegmentIdTable::_probe(const char *id, size_t len, uint64_t h) {
+	size_t mask = _slots.size() - 1;
+	size_t slot = (size_t) (h ^ (h >> 32)) & mask;
+	for (;; slot = (slot + 1) & mask) {
+		size_t i = _slots[slot];
+		if (i == 0)
+			return slot;
+		--i;
+		if (_hashes[i] == h && length(i) == len
+				&& memcmp(str(i), id, len) == 0)
+			return slot;
+	}
+}
+
+/* double the table; keeps the load factor at most 1/2 */
+void SegmentIdTable::_grow(void) {
+	std::vector<size_t> old;
+	old.swap(_slots);
+	_slots.assign(old.size() * 2, 0);
+	size_t mask = _slots.size() - 1;
+	for (size_t j = 0; j < old.size(); j++) {
+		if (old[j] == 0)
+			continue;
+		uint64_t h = _hashes[old[j] - 1];
+		size_t slot = (size_t) (h ^ (h >> 32)) & mask;
+		while (_slots[slot] != 0)
+			slot = (slot + 1) & mask;
+		_slots[slot] = old[j];
+	}
+}
+
+/* index of the ID, or npos if it has not been interned */
+size_t SegmentIdTable::find(const char *id, size_t len) {
+	size_t slot = _probe(id, len, _hash(id, len));
+	return _slots[slot] - 1;
+}
+
+/* index of the ID, interning it first if it is new */
+size_t SegmentIdTable::insert(const char *id, size_t len) {
+	uint64_t h = _hash(id, len);
+	size_t slot = _probe(id, len, h);
+	if (_slots[slot] != 0)
+		return _slots[slot] - 1;
+
+	size_t i = _hashes.size();
+	_arena.insert(_arena.end(), id, id + len);
+	_arena.push_back('\0');
+	_offsets.push_back(_arena.size());
+	_hashes.push_back(h);
+	_slots[slot] = i + 1;
+	if (2 * _hashes.size() > _slots.size())
+		_grow();
+	return i;
+}
+
+/* memory held by the table */
+size_t SegmentIdTable::bytes(void) const {
+	return _arena.capacity() + sizeof(size_t) * (_offsets.capacity()
+			+ _slots.capacity()) + sizeof(uint64_t) * _hashes.capacity();
+}
+
+/* make room for n IDs without growing the hash table */
+void SegmentIdTable::reserve(size_t n) {
+	_offsets.reserve(n + 1);
+	_hashes.reserve(n);
+	while (_slots.size() < 2 * n)
+		_grow();
+}
+
+void SegmentIdTable::clear(void) {
+	_arena.clear();
+	_offsets.assign(1, 0);
+	_hashes.clear();
+	_slots.assign(16, 0);
+}
@@ -0,0 +1,68 @@
+/*
+ * SegmentIdTable.h
+ *
+ * Copyright (C) 2016  Akira Kinoshita <kinoshita@nii.ac.jp>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef SRC_CLASS_SEGMENTIDTABLE_H_
+#define SRC_CLASS_SEGMENTIDTABLE_H_
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+/*
+ * Interned segment IDs.
+ *
+ * Every distinct ID gets a dense index in order of first appearance.  The
+ * strings live in one arena ('\0'-terminated), and lookups go through a
+ * flat open-addressing hash table with linear probing, so that neither
+ * insertion nor lookup allocates per ID.
+ */
+class SegmentIdTable {
+private:
+	/* private member variables */
+	std::vector<char> _arena; /* all IDs, each followed by '\0' */
+	std::vector<size_t> _offsets; /* start of ID i in _arena */
+	std::vector<uint64_t> _hashes; /* hash of ID i */
+	std::vector<size_t> _slots; /* index + 1 of the ID, or 0 if empty */
+
+	/* private member functions */
+	static uint64_t _hash(const char *id, size_t len);
+	size_t _probe(const char *id, size_t len, uint64_t h);
+	void _grow(void);
+
+public:
+	static const size_t npos = (size_t) -1;
+
+	/* constructor & destructor */
+	SegmentIdTable();
+	virtual ~SegmentIdTable();
+
+	/* getter */
+	size_t size(void) const;
+	const char* str(size_t i) const;
+	size_t length(size_t i) const;
+	size_t bytes(void) const;
+
+	/* public member functions */
+	size_t find(const char *id, size_t len);
+	size_t insert(const char *id, size_t len);
+	void reserve(size_t n);
+	void clear(void);
+};
+
+#endif /* SRC_CLASS_SEGMENTIDTABLE_H_ */
@@ -20,7 +20,7 @@
 #include "SegmentObservingVector.h"
 
 template <typename T>
-SegmentObservingVector<T>::SegmentObservingVector(std::string id) :
+SegmentObservingVector<T>::SegmentObservingVector(size_t id) :
 		Segment(id) {
 }
 
@@ -22,15 +22,19 @@
 
 #include "Segment.h"
 #include "ObservedValue.h"
+#include <cstdint>
 
 template <typename T>
 class SegmentObservingVector : public Segment {
 public:
+	typedef T value_type; /* type of each element of an observed vector */
+
 	/* public member variables */
 	std::vector<ObservedValue<std::valarray<T>>> data; /* data sequence */
+	std::vector<int64_t> time; /* timestamp of each datum (bucketed input only) */
 
 	/* constructor & destructor */
-	SegmentObservingVector(std::string id);
+	SegmentObservingVector(size_t id);
 	//virtual ~SegmentObservingVector() = default;
 
 	/* public member functions */
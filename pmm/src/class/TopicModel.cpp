@@ -26,19 +26,59 @@
 #include <algorithm>
 #include <valarray>
 #include <random>
+#include <cstring>
+#include <sstream>
+#include <set>
+#include <deque>
+#include <chrono>
+#include <glob.h>
+#include <unistd.h>
+#ifdef _OPENMP
+#include <omp.h>
+#endif
 #include <gsl/gsl_sf_log.h>
+#include "PmmError.h"
+#include "LineReader.h"
 #include "../lib/util.h"
+#include "../lib/format.h"
 
 template<class T>
 TopicModel<T>::TopicModel(size_t k, size_t d, size_t valueSize, bool doSrand) :
 		_K(k), _D(d), _valueSize(valueSize), _doSrand(doSrand) {
 	_nThres = 0;
+	_dumpFlags = 0;
+	if (doSrand) {
+		std::random_device rd;
+		_rng.seed(rd());
+	}
 	_segments.clear();
+	_stream = NULL;
+	_shardIndex = 0;
+	_nShards = 1;
+	_lazyTol = 0.0;
+	_lazyFullPass = 0;
+	_nLazyItr = 0;
+	_sparseEps = 0.0;
+	_reactivateEvery = 0;
+	_nSparseItr = 0;
+	_batchSize = 0;
+	_stepDecay = 0.6;
+	_nMiniBatchItr = 0;
+	_bucketWidth = 0;
+	_timeFrom = INT64_MIN;
+	_timeTo = INT64_MAX;
+	_dumpStats.valid = false;
+	_storeGamma = true;
+	_readBudget = 0;
+	_affinity = false;
+	_phaseTimes.estep = _phaseTimes.mstep = _phaseTimes.loglik = 0.0;
 }
 
 template<class T>
 TopicModel<T>::~TopicModel() {
 	_clearSegments();
+	for (size_t i = 0; i < _pending.size(); i++)
+		delete _pending[i];
 }
 
 template<class T>
@@ -49,6 +89,15 @@ void TopicModel<T>::_clearSegments(void) {
 		}
 		_segments.clear();
 	}
+	delete _stream;
+	_stream = NULL;
+	_remoteSizes.clear();
+	_streamBlocks.clear();
+	_segmentOfId.clear();
+	_firstUnit.clear();
+	_segStats.clear();
+	_segRange.clear();
+	_dumpStats.valid = false;
 }
 
 template<class T>
@@ -56,29 +105,418 @@ void TopicModel<T>::setThres(size_t nThres) {
 	_nThres = nThres;
 }
 
+/*
+ * Set the DumpFlag bits used by saveDataDump().
+ */
 template<class T>
-void TopicModel<T>::readDataFile(FILE *fp, bool forceadd) {
-	std::unordered_map<std::string, T*> hashtable;
-	size_t c = 0;
+void TopicModel<T>::setDumpFlags(size_t flags) {
+	_dumpFlags = flags;
+}
+
+/* DumpFlag bits of the dump last read or measured */
+template<class T>
+size_t TopicModel<T>::getDumpFlags(void) {
+	return _dumpFlags;
+}
+
+/*
+ * Enable lazy EM (see _lazyLocalEM()) with the given tolerance, recomputing
+ * all segments every fullPass iterations.  tol = 0 disables it.
+ */
+template<class T>
+void TopicModel<T>::setLazy(double tol, size_t fullPass) {
+	_lazyTol = tol;
+	_lazyFullPass = fullPass;
+	_nLazyItr = 0;
+}
+
+/*
+ * Drop components whose theta falls below eps from the active list of each
+ * segment, re-checking all of them every reactivateEvery iterations (0:
+ * never).  eps = 0 disables it.
+ */
+template<class T>
+void TopicModel<T>::setSparse(double eps, size_t reactivateEvery) {
+	_sparseEps = eps;
+	_reactivateEvery = reactivateEvery;
+	_nSparseItr = 0;
+}
+
+/*
+ * Mini-batch EM (see miniBatchEMAlgorithm()) with the given number of
+ * segments per batch and step size decay in (0.5, 1].
+ */
+template<class T>
+void TopicModel<T>::setMiniBatch(size_t segments, double decay) {
+	_batchSize = segments;
+	_stepDecay = decay;
+	_nMiniBatchItr = 0;
+	_batchStats.clear();
+}
+
+/*
+ * Make readDataFile() and readDataFiles() fail as soon as the records read
+ * so far would need more than bytes in memory even without their
+ * responsibilities (see _checkReadBudget()).  0 disables the check.
+ */
+template<class T>
+void TopicModel<T>::setReadBudget(size_t bytes) {
+	_readBudget = bytes;
+}
+
+/*
+ * Whether the responsibilities of every record are kept between the E-step
+ * and the M-step (MEMORY_GAMMA).  Without them, each segment is processed
+ * by a fused E- and M-step (MEMORY_FUSED), which gives the same estimates
+ * for K doubles less per record.  Applies to the loaded segments as well.
+ */
+template<class T>
+void TopicModel<T>::setStoreGamma(bool store) {
+	_storeGamma = store;
+	for (T *seg : _segments) {
+		for (auto& ov : seg->data) {
+			if (store)
+				ov.initLatentParams(_K);
+			else
+				ov.gamma.resize(0);
+		}
+	}
+}
+
+/*
+ * NUMA-friendly EM in memory: every thread always works on the same work
+ * units (contiguous, balanced by records), and the records of the segments
+ * are copied by their owner threads once, so that with the default
+ * first-touch policy they live on the node of the thread that reads them.
+ * Applies to the loaded segments; call again after loading others.
+ */
+template<class T>
+void TopicModel<T>::setAffinity(bool affinity) {
+	_affinity = affinity;
+	if (affinity && _stream == NULL)
+		_placeSegments();
+}
+
+template<class T>
+PhaseTimes TopicModel<T>::getPhaseTimes(void) {
+	return _phaseTimes;
+}
+
+/* theta of a new segment, and the responsibilities if they are kept */
+template<class T>
+void TopicModel<T>::_initLatentParams(T *seg) {
+	if (_storeGamma)
+		seg->initLatentParams(_K);
+	else
+		seg->Segment::initLatentParams(_K);
+}
+
+/*
+ * Group the records of each segment by buckets of the given width (in
+ * seconds) in dumps written with DUMP_BUCKETED.  Must be set before
+ * readDataFile() so that the timestamps are kept.
+ */
+template<class T>
+void TopicModel<T>::setBucketWidth(size_t seconds) {
+	_bucketWidth = seconds;
+}
+
+/*
+ * Use only records with timestamps in [from, to).  CSV lines are filtered
+ * by their timestamp; from time-bucketed dumps, only the buckets starting
+ * in the range are read.
+ */
+template<class T>
+void TopicModel<T>::setTimeRange(int64_t from, int64_t to) {
+	_timeFrom = from;
+	_timeTo = to;
+}
+
+/*
+ * Write the mixing coefficients to path as a binary matrix (see
+ * _writeThetaBinary()) instead of as text rows in dump().
+ */
+template<class T>
+void TopicModel<T>::setThetaOutput(const std::string& path) {
+	_thetaPath = path;
+}
+
+template<class T>
+bool TopicModel<T>::_hasTimeRange(void) {
+	return _timeFrom != INT64_MIN || _timeTo != INT64_MAX;
+}
+
+template<class T>
+bool TopicModel<T>::_inTimeRange(int64_t t) {
+	return _timeFrom <= t && t < _timeTo;
+}
+
+/* bucket of timestamp t (rounded down also for negative t) */
+template<class T>
+int64_t TopicModel<T>::_bucketOf(int64_t t) {
+	int64_t w = (int64_t) _bucketWidth;
+	return (t >= 0) ? t / w : -((-t + w - 1) / w);
+}
+
+/*
+ * Restrict loadDataDump() and openDataStream() to the index-th of count
+ * contiguous parts of the segments in the dump.
+ */
+template<class T>
+void TopicModel<T>::setShard(size_t index, size_t count) {
+	_shardIndex = index;
+	_nShards = count;
+}
+
+template<class T>
+void TopicModel<T>::_shardRange(size_t s, size_t& begin, size_t& end) {
+	begin = s * _shardIndex / _nShards;
+	end = s * (_shardIndex + 1) / _nShards;
+}
+
+/* bytes of CSV input read at a time by the pipelined readDataFile() */
+static const size_t ingestBlockBytes = 4 << 20;
+
+/* records between checks of the read budget in readDataFiles() */
+static const size_t readBudgetRecords = 1 << 16;
+
+/*
+ * Read the lines of a file, adding the records to nRead (shared by the
+ * files read in parallel) and checking the budget every readBudgetRecords.
+ */
+template<class T>
+size_t TopicModel<T>::_readLines(FILE *fp, std::vector<T*>& table,
+		SegmentIdTable& ids, bool forceadd, std::atomic<size_t>& nRead) {
+	size_t c = 0, pending = 0;
 	char *buf = NULL;
 	size_t n = 0;
-	while (getline(&buf, &n, fp) >= 0) {
-		if (_readDataFileLine(hashtable, buf, forceadd))
-			++c;
+	try {
+		while (getline(&buf, &n, fp) >= 0) {
+			if (_readDataFileLine(table, ids, buf, forceadd)) {
+				++c;
+				if (++pending == readBudgetRecords) {
+					/* the segments of this file are a lower bound */
+					_checkReadBudget(ids.size(), nRead += pending);
+					pending = 0;
+				}
+			}
+		}
+	} catch (...) {
+		free(buf);
+		throw;
 	}
 	free(buf);
+	nRead += pending;
+	return c;
+}
+
+/*
+ * Fail if nRecords records of nSegments segments need more than
+ * _readBudget bytes with the fused layout, the smallest in memory.
+ */
+template<class T>
+void TopicModel<T>::_checkReadBudget(size_t nSegments, size_t nRecords) {
+	if (_readBudget == 0)
+		return;
+	size_t bytes = estimateMemory(MEMORY_FUSED, nSegments, nRecords, 0,
+			0).total();
+	if (bytes > _readBudget) {
+		fail("the first ", nRecords, " records already need ", bytes >> 20,
+				" MiB, more than the memory budget of ", _readBudget >> 20,
+				" MiB.");
+	}
+}
+
+/*
+ * Parse the lines of a block ('\0'-terminated, lines separated by '\n').
+ * The newlines are overwritten.
+ */
+template<class T>
+size_t TopicModel<T>::_readBlockLines(char *block, size_t len,
+		std::vector<T*>& table, SegmentIdTable& ids, bool forceadd) {
+	size_t c = 0;
+	char *end = block + len;
+	for (char *line = block; line < end;) {
+		char *nl = (char *) memchr(line, '\n', end - line);
+		char *next = (nl != NULL) ? nl + 1 : end;
+		if (nl != NULL)
+			*nl = '\0';
+		if (_readDataFileLine(table, ids, line, forceadd))
+			++c;
+		line = next;
+	}
+	return c;
+}
+
+/*
+ * Append the segments of a partial table (with its own IDs) to table,
+ * after the records already there.  The partial table is emptied.
+ */
+template<class T>
+void TopicModel<T>::_mergeTable(std::vector<T*>& table, std::vector<T*>& part,
+		SegmentIdTable& partIds) {
+	for (size_t i = 0; i < part.size(); i++) {
+		T *p = part[i];
+		if (p == NULL)
+			continue;
+		T *seg = _searchSegment(table, _ids, partIds.str(i), partIds.length(i),
+				true);
+		if (seg->data.empty()) {
+			seg->data.swap(p->data);
+			seg->time.swap(p->time);
+		} else {
+			for (auto& x : p->data)
+				seg->data.push_back(std::move(x));
+			seg->time.insert(seg->time.end(), p->time.begin(), p->time.end());
+		}
+		delete p;
+	}
+	std::vector<T*>().swap(part);
+	partIds.clear();
+}
+
+/*
+ * Read a CSV stream through a pipeline: a LineReader thread reads blocks
+ * of lines ahead, and each batch of blocks is parsed in parallel: the
+ * first block directly into the data set, the others into partial tables
+ * (one per block), which are then merged in stream order.  The result
+ * equals that of reading the lines one by one.
+ */
+template<class T>
+void TopicModel<T>::readDataFile(FILE *fp, bool forceadd) {
+	std::vector<T*> table; /* segments by ID index */
+	_clearSegments();
+	_ids.clear();
+#ifdef _OPENMP
+	size_t nBatch = omp_get_max_threads();
+#else
+	size_t nBatch = 1;
+#endif
+	std::vector<std::vector<T*>> parts(nBatch);
+	std::vector<SegmentIdTable> partIds(nBatch);
+	std::vector<char*> blocks(nBatch);
+	std::vector<size_t> lengths(nBatch);
+	std::vector<size_t> counts(nBatch);
+	size_t c = 0;
+	try {
+		/* the reader fills the next batch while this one is parsed */
+		LineReader reader(fp, ingestBlockBytes, 2 * nBatch);
+		for (;;) {
+			size_t n = 0;
+			while (n < nBatch && (blocks[n] = reader.next(lengths[n])) != NULL)
+				++n;
+			if (n == 0)
+				break;
+			ParallelErrors errors;
+#ifdef _OPENMP
+#pragma omp parallel for schedule(dynamic, 1)
+#endif
+			for (size_t b = 0; b < n; b++) {
+				errors.run([&] {
+					if (b == 0) /* nothing is merged before it */
+						counts[b] = _readBlockLines(blocks[b], lengths[b], table,
+								_ids, forceadd);
+					else
+						counts[b] = _readBlockLines(blocks[b], lengths[b],
+								parts[b], partIds[b], forceadd);
+				});
+			}
+			errors.rethrow();
+			for (size_t b = 0; b < n; b++) {
+				if (b > 0)
+					_mergeTable(table, parts[b], partIds[b]);
+				c += counts[b];
+				reader.release();
+			}
+			_checkReadBudget(_ids.size(), c);
+		}
+	} catch (...) {
+		for (size_t b = 0; b < nBatch; b++)
+			for (T *seg : parts[b])
+				delete seg;
+		for (T *seg : table)
+			delete seg;
+		throw;
+	}
 	std::cerr << "added " << c << " records" << std::endl;
-	_hash2list(hashtable);
+	_hash2list(table);
+}
+
+/*
+ * Read several CSV files as if they were concatenated in the given order;
+ * glob patterns among them are expanded in sorted order.  Each file is
+ * parsed by its own thread into a partial table with its own IDs; the
+ * partial tables are then merged file by file, so that segments
+ * are listed in order of first appearance and the records of a segment
+ * keep the order of the files and of the lines in each file.
+ */
+template<class T>
+void TopicModel<T>::readDataFiles(const std::vector<std::string>& patterns) {
+	std::vector<std::string> paths;
+	for (const std::string& pattern : patterns) {
+		glob_t g;
+		if (glob(pattern.c_str(), GLOB_NOCHECK, NULL, &g) != 0)
+			fail(pattern, ": glob failed");
+		paths.insert(paths.end(), g.gl_pathv, g.gl_pathv + g.gl_pathc);
+		globfree(&g);
+	}
+	size_t nFiles = paths.size();
+	std::vector<std::vector<T*>> tables(nFiles);
+	std::vector<SegmentIdTable> fileIds(nFiles);
+	std::vector<size_t> counts(nFiles, 0);
+	std::atomic<size_t> nRead(0);
+	_clearSegments();
+	_ids.clear();
+
+	ParallelErrors errors;
+#ifdef _OPENMP
+#pragma omp parallel for schedule(dynamic, 1)
+#endif
+	for (size_t f = 0; f < nFiles; f++) {
+		errors.run([&] {
+			FILE *fp = fopen(paths[f].c_str(), "r");
+			if (fp == NULL)
+				failErrno(paths[f].c_str());
+			try {
+				counts[f] = _readLines(fp, tables[f], fileIds[f], true, nRead);
+			} catch (...) {
+				fclose(fp);
+				throw;
+			}
+			fclose(fp);
+		});
+	}
+	try {
+		errors.rethrow();
+	} catch (...) {
+		for (size_t f = 0; f < nFiles; f++)
+			for (T *seg : tables[f])
+				delete seg;
+		throw;
+	}
+
+	std::vector<T*> table; /* segments by (global) ID index */
+	size_t c = 0;
+	for (size_t f = 0; f < nFiles; f++) {
+		_mergeTable(table, tables[f], fileIds[f]);
+		c += counts[f];
+	}
+	std::cerr << "added " << c << " records from " << nFiles << " files"
+			<< std::endl;
+	_hash2list(table);
 }
 
+/* segments are listed in order of first appearance of their IDs */
 template<class T>
-void TopicModel<T>::_hash2list(std::unordered_map<std::string, T*>& hashtable) {
+void TopicModel<T>::_hash2list(std::vector<T*>& table) {
 	_clearSegments();
 
-	for (auto itr = hashtable.begin(); itr != hashtable.end(); ++itr) {
-		T *seg = itr->second;
+	for (auto itr = table.begin(); itr != table.end(); ++itr) {
+		T *seg = *itr;
+		if (seg == NULL)
+			continue;
 		if (seg->data.size() >= _nThres) {
-			seg->initLatentParams(_K);
+			_initLatentParams(seg);
 			_segments.push_back(seg);
 		} else {
 			delete seg;
@@ -91,242 +529,2762 @@ void TopicModel<T>::_hash2list(std::unordered_map<std::string, T*>& hashtable) {
  * FILE *fp must be opened in binary mode.
  *
  * The binary file format is as follows:
+ * (optional: sizeof(size_t) bytes: PMM_DUMP_MAGIC
+ *            sizeof(size_t) bytes: DumpFlag bits F
+ *            if F contains DUMP_BUCKETED {
+ *              sizeof(size_t) bytes: bucket width W in seconds
+ *            })
  * Initial   sizeof(size_t) bytes: the dimension D
  * following sizeof(size_t) bytes: bytes per value T
  * following sizeof(size_t) bytes: number of segments S
+ * if F contains DUMP_STATS {
+ *   sizeof(size_t) bytes: size of the following statistics in bytes
+ *   sizeof(size_t) bytes: 1 if valid, 0 if records have been appended since
+ *   sizeof(size_t) bytes: total number of records
+ *   sizeof(size_t) bytes: number H of distinct segment sizes
+ *   repeat H times, in increasing order of the size {
+ *     sizeof(size_t) bytes: segment size (records)
+ *     sizeof(size_t) bytes: number of segments of this size
+ *   }
+ *   sizeof(double) * D bytes: minimum value of each dimension
+ *   sizeof(double) * D bytes: maximum value of each dimension
+ * }
  * repeat S times {
  *   initial   sizeof(size_t)   bytes: the number of data N
  *   following sizeof(size_t)   bytes: segment ID string length L
  *   following sizeof(char) * L bytes: segment ID string (does not contain trailing '\0')
- *   repeat N times {
- *      T * D bytes: observed data point vector
+ *   if F contains DUMP_BUCKETED {
+ *      sizeof(size_t) bytes: number of buckets M
+ *      repeat M times, in increasing order of b {
+ *        sizeof(int64_t) bytes: bucket b (records with b * W <= time < (b + 1) * W)
+ *        sizeof(size_t) bytes: number of records N_b in the bucket
+ *        sizeof(size_t) bytes: size B_b of the records block of the bucket
+ *      }
+ *      M records blocks of N_b records each, in the same order
+ *   } else {
+ *      one records block of N records
  *   }
  * }
+ * where a records block of n records is
+ *   if F contains DUMP_PACKED {
+ *      (only if not DUMP_BUCKETED: sizeof(size_t) bytes: block size B)
+ *      B bytes: n * D values packed by bitpack()
+ *   } else repeat n times {
+ *      T * D bytes: observed data point vector
+ *   }
+ * If F contains DUMP_CHUNKED, more chunks follow until the end of the file,
+ * each of them a number of segments S' and S' segments as above, written by
+ * appendDataDump().  A segment ID may appear in several chunks; its records
+ * are those of all chunks, in chunk order.
  */
 template<class T>
 void TopicModel<T>::loadDataDump(FILE *fp) {
 	_clearSegments();
+	_ids.clear();
 	rewind(fp);
 
 	/* read header */
-	size_t d;
-	if (fread(&d, sizeof(size_t), 1, fp) != 1)
-		die("fread");
-	if (d != _D) {
-		std::cerr << "dimension mismatch:" << " assuming " << _D
-				<< " but dump is " << d << "-D." << std::endl;
-		exit(1);
+	size_t s = _readDumpHeader(fp);
+	if (_dumpFlags & DUMP_CHUNKED) {
+		_loadChunkedDump(fp, s);
+		return;
 	}
-	size_t t;
-	if (fread(&t, sizeof(size_t), 1, fp) != 1)
-		die("fread");
-	if (t != _valueSize) {
-		std::cerr << "number type mismatch:" << " assuming " << _valueSize
-				<< " bytes/value," << " but " << t << "." << std::endl;
-		exit(1);
+	size_t begin, end;
+	_shardRange(s, begin, end);
+	if (_dumpStats.valid) {
+		_segments.reserve(end - begin);
+		_ids.reserve(end - begin);
 	}
 
-	/* number of segments */
-	size_t s;
-	if (fread(&s, sizeof(size_t), 1, fp) != 1)
-		die("fread");
-
 	/* read segment data */
 	size_t c = 0;
 	for (size_t i = 0; i < s; i++) {
-		if (_loadSegmentDataFromDump(fp))
+		if (i < begin || i >= end)
+			_skipSegmentInDump(fp);
+		else if (_loadSegmentDataFromDump(fp))
 			++c;
 	}
 
 	/* check */
 	if (c != _segments.size()) {
-		std::cerr << "number of segments mismatch:" << _segments.size()
-				<< " vs " << c << std::endl;
-		exit(1);
-	}
-}
-
-template<class T>
-void TopicModel<T>::saveDataDump(const char *path) {
-	FILE *fp = fopen(path, "wb");
-	if (fp == NULL)
-		die("fopen");
-	if (fwrite(&_D, sizeof(size_t), 1, fp) != 1)
-		die("fwrite");
-	if (fwrite(&_valueSize, sizeof(size_t), 1, fp) != 1)
-		die("fwrite");
-	size_t nSegs = _segments.size();
-	if (fwrite(&nSegs, sizeof(size_t), 1, fp) != 1)
-		die("fwrite");
-	for (size_t s = 0; s < nSegs; s++) {
-		if (!_saveSegmentDataToDump(fp, _segments[s])) {
-			std::cerr << "failed dumping segment data." << std::endl;
-			exit(1);
-		}
+		fail("number of segments mismatch:", _segments.size(), " vs ", c);
 	}
-	if (fclose(fp) != 0)
-		die("fclose");
 }
 
-template<class T>
-T* TopicModel<T>::_searchSegment(std::unordered_map<std::string, T*>& hashtable,
-		std::string id, bool forceadd) {
-	T *res = NULL;
-	auto itr = hashtable.find(id);
-	if (itr != hashtable.end()) {
-		/* found */
-		res = itr->second;
-	} else if (forceadd) {
-		/* not found and force add */
-		res = new T(id);
-		hashtable[id] = res;
-	}
-	return res;
-}
+/*
+ * loadDataDump() overlapped with the first EM iteration.  This thread reads
+ * the segments and hands them in batches to the other threads of the team,
+ * which run the E-step and the segment-local M-step on them (as
+ * _EMUnits(), like the fused layout) while later segments are still being
+ * read.  Only the reduction of the sufficient statistics, in unit order,
+ * and the update of the distribution parameters wait for the end of the
+ * file.  The result is that of loadDataDump() and EMAlgorithm() bit for
+ * bit; the initial parameters must not depend on the data, and lazy EM is
+ * not overlapped.
+ */
+static const size_t pipelineBatchSegments = 64;
+static const size_t pipelineBatchRecords = 1 << 16;
 
 template<class T>
-void TopicModel<T>::printDataStats(void) {
-	size_t n = 0, _S = _segments.size();
-	for (auto itr = _segments.begin(); itr != _segments.end(); ++itr) {
-		n += (*itr)->data.size();
+void TopicModel<T>::loadDataDumpWithEM(FILE *fp) {
+	if (_lazyTol > 0.0) {
+		loadDataDump(fp);
+		EMAlgorithm();
+		return;
 	}
-	std::cerr << "total " << _S << " segments" << std::endl;
-	std::cerr << "using " << n << " records" << std::endl;
-
-	std::vector<size_t> vec(_S);
+	_clearSegments();
+	_ids.clear();
+	rewind(fp);
 
-	unsigned long sum = 0;
-	for (size_t s = 0; s < _S; s++) {
-		vec[s] = _segments[s]->data.size();
-		sum += vec[s];
+	size_t s = _readDumpHeader(fp);
+	if (_dumpFlags & DUMP_CHUNKED) {	/* IDs are merged after reading */
+		_loadChunkedDump(fp, s);
+		EMAlgorithm();
+		return;
 	}
-	std::sort(vec.begin(), vec.end());
-
-	double mean = (double) sum / (double) _S;
-	double var = 0.0;
-	for (size_t s = 0; s < _S; s++) {
-		double d = (double) (_segments[s]->data.size()) - mean;
-		var += d * d;
+	size_t begin, end;
+	_shardRange(s, begin, end);
+	if (_dumpStats.valid) {
+		_segments.reserve(end - begin);
+		_ids.reserve(end - begin);
 	}
-	var /= (double) _S;
-	std::cerr << "n_data-mean = " << mean << ", n_data-variance = " << var
-			<< std::endl;
-	std::cerr << "n_data-min = " << vec[0] << ", n_data-max = " << vec[_S - 1]
-			<< std::endl;
-	std::cerr << "n_data-quantile: " << vec[_S / 4] << ", " << vec[_S / 2]
-			<< ", " << vec[_S / 4 * 3] << std::endl;
-}
-
-template<class T>
-void TopicModel<T>::dump(void) {
-	std::cout << "# of Mixture : " << _K << std::endl;
-	std::cout << "Dimension : " << _D << std::endl;
-
-	_dumpTopicParamsAndSegments();
-}
+	_sparseStep();
 
-template<class T>
-double TopicModel<T>::logLikelihood(void) {
-	double res = 0.0;
-	size_t s, n, k;
+	size_t dim = _bytesPerRecord() / sizeof(ValueT);
+	size_t nStats = _numberOfSufficientStatistics();
+	std::deque<std::vector<double>> partials; /* per batch, per unit */
+	std::vector<T*> segs;
+	size_t batchRecords = 0, batchUnits = 0, c = 0;
+	ParallelErrors errors; /* of the tasks */
+	std::exception_ptr readError;
 
 #ifdef _OPENMP
-#pragma omp parallel for private(n, k) reduction(+:res)
+#pragma omp parallel
+#pragma omp single
 #endif
-	for (s = 0; s < _segments.size(); s++) {
-		T *seg = _segments[s];
-		for (n = 0; n < seg->data.size(); n++) {
-			double tmp = 0.0;
-			for (k = 0; k < _K; k++) {
-				tmp += seg->theta[k] * _pdf(s, n, k);
-			}
-#ifdef DEBUG
-			switch (fpclassify(tmp)) {
-				case FP_INFINITE:
-				case FP_NAN:
-				case FP_SUBNORMAL:
-				case FP_ZERO:
-				fprintf(stderr, "tmp = %e\n", tmp);
-				for (k = 0; k < almighty->K; k++) {
-					fprintf(stderr, "theta[%u] = %e, po(x) = %e\n",
-							k, seg->theta[k], pdf(almighty, s, k, seg->data[n]));
+	try {
+		for (size_t i = 0; i <= s; i++) {
+			if (i < s) {
+				if (i < begin || i >= end) {
+					_skipSegmentInDump(fp);
+					continue;
 				}
-				break;
-				default: // FP_NORMAL
+				if (!_loadSegmentDataFromDump(fp))
+					continue;
+				++c;
+				segs.push_back(_segments.back());
+				batchRecords += _segments.back()->data.size();
+				batchUnits += _unitCount(_segments.back()->data.size());
+				if (segs.size() < pipelineBatchSegments
+						&& batchRecords < pipelineBatchRecords)
+					continue;
+			} else if (segs.empty()) {
 				break;
 			}
+
+			/* a task for the batch; segs and st are copied into it */
+			partials.emplace_back(batchUnits * nStats, 0.0);
+			double *st = partials.back().data();
+#ifdef _OPENMP
+#pragma omp task firstprivate(segs, st)
 #endif
-			double r;
-			if (tmp == 0.0) {
-				tmp = DBL_MIN; /* avoiding zero... */
-			}
-			if (!std::isnormal(r = gsl_sf_log(tmp)))
-				die("gsl_sf_log");
-			res += r;
+			errors.run([&] {
+				std::vector<ValueT> x;
+				double *unitStats = st;
+				for (size_t j = 0; j < segs.size(); j++) {
+					T *seg = segs[j];
+					size_t nData = seg->data.size();
+					x.resize(nData * dim);
+					for (size_t n = 0; n < nData; n++) {
+						for (size_t d = 0; d < dim; d++)
+							x[n * dim + d] = seg->data[n].value[d];
+					}
+					_EMUnits(seg, x.data(), nData, unitStats);
+					unitStats += _unitCount(nData) * nStats;
+				}
+			});
+			segs.clear();
+			batchRecords = batchUnits = 0;
 		}
+	} catch (...) {
+		readError = std::current_exception();
 	}
-	return res;
+	if (readError)
+		std::rethrow_exception(readError);
+	errors.rethrow();
+	if (c != _segments.size()) {
+		fail("number of segments mismatch:", _segments.size(), " vs ", c);
+	}
+
+	std::valarray<double> stats(0.0, nStats);
+	std::vector<double> delta(nStats, 0.0);
+	for (const std::vector<double>& p : partials) {
+		for (size_t j = 0; j < nStats; j++) {
+			kahanAccumulate(&stats[j], &delta[j], &p[j], p.size() / nStats,
+					nStats);
+		}
+	}
+	_updateDistParams(&stats[0]);
 }
 
+/*
+ * Read and check the dump header, and return the number of segments.
+ */
 template<class T>
-void TopicModel<T>::AIC(void) {
-	double params = _numberOfModelParameters();
-	double likelihood = logLikelihood();
+size_t TopicModel<T>::_readDumpHeader(FILE *fp) {
+	size_t d;
+	if (fread(&d, sizeof(size_t), 1, fp) != 1)
+		failErrno("fread");
+	_dumpFlags = 0;
+	if (d == PMM_DUMP_MAGIC) {
+		if (fread(&_dumpFlags, sizeof(size_t), 1, fp) != 1)
+			failErrno("fread");
+		if (_dumpFlags & ~((size_t) (DUMP_PACKED | DUMP_BUCKETED
+				| DUMP_CHUNKED | DUMP_STATS))) {
+			fail("unsupported dump flags: ", _dumpFlags);
+		}
+		if ((_dumpFlags & DUMP_BUCKETED)
+				&& (fread(&_bucketWidth, sizeof(size_t), 1, fp) != 1
+						|| _bucketWidth == 0))
+			failErrno("fread");
+		if (fread(&d, sizeof(size_t), 1, fp) != 1)
+			failErrno("fread");
+	}
+	if (_hasTimeRange() && !(_dumpFlags & DUMP_BUCKETED)) {
+		fail("a time range needs a time-bucketed dump (csv2dump --bucket).");
+	}
+	if (d != _D) {
+		fail("dimension mismatch: assuming ", _D, " but dump is ", d, "-D.");
+	}
+	size_t t;
+	if (fread(&t, sizeof(size_t), 1, fp) != 1)
+		failErrno("fread");
+	if (t != _valueSize) {
+		fail("number type mismatch: assuming ", _valueSize,
+				" bytes/value, but ", t, ".");
+	}
 
-	fprintf(stderr, "AIC = %f\n", -2 * likelihood + 2 * params);
-	fprintf(stderr, "1st term (likelihood) = %f\n", -2 * likelihood);
-	fprintf(stderr, "2nd term (parameters) = %f\n", 2 * params);
+	/* number of segments */
+	size_t s;
+	if (fread(&s, sizeof(size_t), 1, fp) != 1)
+		failErrno("fread");
+	_dumpStats.valid = false;
+	if (_dumpFlags & DUMP_STATS)
+		_readDumpStats(fp);
+	return s;
 }
 
 template<class T>
-void TopicModel<T>::EMAlgorithm(void) {
-	_Estep();
-	_Mstep();
+void TopicModel<T>::_readDumpStats(FILE *fp) {
+	size_t dim = _bytesPerRecord() / sizeof(ValueT);
+	size_t bytes, valid, h;
+	if (fread(&bytes, sizeof(size_t), 1, fp) != 1
+			|| fread(&valid, sizeof(size_t), 1, fp) != 1
+			|| fread(&_dumpStats.nRecords, sizeof(size_t), 1, fp) != 1
+			|| fread(&h, sizeof(size_t), 1, fp) != 1)
+		failErrno("fread");
+	if (bytes != (3 + 2 * h) * sizeof(size_t) + 2 * dim * sizeof(double))
+		fail("broken statistics in dump.");
+	_dumpStats.sizes.resize(h);
+	_dumpStats.valueMin.resize(dim);
+	_dumpStats.valueMax.resize(dim);
+	for (size_t i = 0; i < h; i++) {
+		if (fread(&_dumpStats.sizes[i].first, sizeof(size_t), 1, fp) != 1
+				|| fread(&_dumpStats.sizes[i].second, sizeof(size_t), 1, fp) != 1)
+			failErrno("fread");
+	}
+	if (fread(_dumpStats.valueMin.data(), sizeof(double), dim, fp) != dim
+			|| fread(_dumpStats.valueMax.data(), sizeof(double), dim, fp) != dim)
+		failErrno("fread");
+	_dumpStats.valid = (valid == 1);
 }
 
 template<class T>
-void TopicModel<T>::_Estep(void) {
-	size_t s, n, k;
+void TopicModel<T>::_writeDumpStats(FILE *fp, const DumpStats& stats) {
+	size_t dim = _bytesPerRecord() / sizeof(ValueT);
+	size_t h = stats.sizes.size();
+	size_t bytes = (3 + 2 * h) * sizeof(size_t) + 2 * dim * sizeof(double);
+	size_t valid = stats.valid ? 1 : 0;
+	if (fwrite(&bytes, sizeof(size_t), 1, fp) != 1
+			|| fwrite(&valid, sizeof(size_t), 1, fp) != 1
+			|| fwrite(&stats.nRecords, sizeof(size_t), 1, fp) != 1
+			|| fwrite(&h, sizeof(size_t), 1, fp) != 1)
+		failErrno("fwrite");
+	for (size_t i = 0; i < h; i++) {
+		if (fwrite(&stats.sizes[i].first, sizeof(size_t), 1, fp) != 1
+				|| fwrite(&stats.sizes[i].second, sizeof(size_t), 1, fp) != 1)
+			failErrno("fwrite");
+	}
+	if (fwrite(stats.valueMin.data(), sizeof(double), dim, fp) != dim
+			|| fwrite(stats.valueMax.data(), sizeof(double), dim, fp) != dim)
+		failErrno("fwrite");
+}
 
-	/* compute gamma[s][n][k] */
-#ifdef _OPENMP
-#pragma omp parallel for private(n, k) schedule(dynamic)
-#endif
-	for (s = 0; s < _segments.size(); s++) {
-		T *seg = _segments[s];
-		for (n = 0; n < seg->data.size(); n++) {
-			std::valarray<double> g(_K);
-			for (k = 0; k < _K; k++) {
-				g[k] = _pdf(s, n, k);
+/* DumpStats of the loaded segments */
+template<class T>
+void TopicModel<T>::_computeDumpStats(DumpStats& stats) {
+	size_t dim = _bytesPerRecord() / sizeof(ValueT);
+	std::vector<size_t> sizes(_segments.size());
+	stats.valid = true;
+	stats.nRecords = 0;
+	stats.valueMin.assign(dim, 0.0);
+	stats.valueMax.assign(dim, 0.0);
+	for (size_t s = 0; s < _segments.size(); s++) {
+		const T *seg = _segments[s];
+		sizes[s] = seg->data.size();
+		for (size_t n = 0; n < seg->data.size(); n++) {
+			for (size_t d = 0; d < dim; d++) {
+				double v = (double) seg->data[n].value[d];
+				if (stats.nRecords == 0 || v < stats.valueMin[d])
+					stats.valueMin[d] = v;
+				if (stats.nRecords == 0 || v > stats.valueMax[d])
+					stats.valueMax[d] = v;
 			}
-			seg->data[n].gamma = seg->theta * g;
-			double gamma_denom = seg->data[n].gamma.sum();
+			++stats.nRecords;
+		}
+	}
+	std::sort(sizes.begin(), sizes.end());
+	stats.sizes.clear();
+	for (size_t s = 0; s < sizes.size(); s++) {
+		if (stats.sizes.empty() || stats.sizes.back().first != sizes[s])
+			stats.sizes.push_back(std::make_pair(sizes[s], (size_t) 0));
+		++stats.sizes.back().second;
+	}
+}
+
+template<class T>
+void TopicModel<T>::_skipSegmentInDump(FILE *fp) {
+	size_t nData, nId;
+	if (fread(&nData, sizeof(size_t), 1, fp) != 1)
+		failErrno("fread");
+	if (fread(&nId, sizeof(size_t), 1, fp) != 1)
+		failErrno("fread");
+	if (fseek(fp, (long) nId, SEEK_CUR) < 0)
+		failErrno("fseek");
+	std::vector<RecordBlock> blocks;
+	_readBlockIndex(fp, nData, blocks);
+	_skipBlocks(fp, blocks);
+}
+
+/*
+ * Size of the records block of a segment whose header has just been read.
+ * For packed dumps, this consumes the block size field.
+ */
+template<class T>
+size_t TopicModel<T>::_recordsBlockBytes(FILE *fp, size_t nData) {
+	if (!(_dumpFlags & DUMP_PACKED))
+		return _bytesPerRecord() * nData;
+	size_t bytes;
+	if (fread(&bytes, sizeof(size_t), 1, fp) != 1)
+		failErrno("fread");
+	return bytes;
+}
+
+/*
+ * Read the index of the records blocks of a segment whose ID has just been
+ * read: one block per bucket in bucketed dumps, a single one otherwise.
+ */
+template<class T>
+void TopicModel<T>::_readBlockIndex(FILE *fp, size_t nData,
+		std::vector<RecordBlock>& blocks) {
+	if (!(_dumpFlags & DUMP_BUCKETED)) {
+		RecordBlock b = { 0, nData, _recordsBlockBytes(fp, nData) };
+		blocks.assign(1, b);
+		return;
+	}
+	size_t m;
+	if (fread(&m, sizeof(size_t), 1, fp) != 1)
+		failErrno("fread");
+	blocks.resize(m);
+	size_t n = 0;
+	for (size_t i = 0; i < m; i++) {
+		if (fread(&blocks[i].bucket, sizeof(int64_t), 1, fp) != 1
+				|| fread(&blocks[i].nData, sizeof(size_t), 1, fp) != 1
+				|| fread(&blocks[i].bytes, sizeof(size_t), 1, fp) != 1)
+			failErrno("fread");
+		n += blocks[i].nData;
+	}
+	if (n != nData) {
+		fail("broken bucket index in dump.");
+	}
+}
+
+/*
+ * Blocks [first, last) are those in the time range; since buckets are
+ * sorted, they are contiguous.  Returns the number of their records.
+ */
+template<class T>
+size_t TopicModel<T>::_selectBlocks(const std::vector<RecordBlock>& blocks,
+		size_t& first, size_t& last) {
+	first = 0;
+	last = blocks.size();
+	if (_hasTimeRange()) {
+		int64_t w = (int64_t) _bucketWidth;
+		while (first < last && blocks[first].bucket * w < _timeFrom)
+			++first;
+		while (last > first && blocks[last - 1].bucket * w >= _timeTo)
+			--last;
+	}
+	size_t n = 0;
+	for (size_t i = first; i < last; i++)
+		n += blocks[i].nData;
+	return n;
+}
+
+template<class T>
+bool TopicModel<T>::_decodeBlocks(const unsigned char *in,
+		const std::vector<RecordBlock>& blocks, size_t first, size_t last,
+		ValueT *x) {
+	size_t dim = _bytesPerRecord() / sizeof(ValueT);
+	for (size_t i = first; i < last; i++) {
+		if (!_decodeRecords(in, blocks[i].bytes, blocks[i].nData, x))
+			return false;
+		in += blocks[i].bytes;
+		x += blocks[i].nData * dim;
+	}
+	return true;
+}
+
+/*
+ * Read the records of blocks [first, last) of a segment whose index has just
+ * been read, and leave fp at the end of the segment.
+ */
+template<class T>
+void TopicModel<T>::_readBlocks(FILE *fp, const std::vector<RecordBlock>& blocks,
+		size_t first, size_t last, ValueT *x) {
+	size_t before = 0, bytes = 0, after = 0;
+	for (size_t i = 0; i < blocks.size(); i++) {
+		(i < first ? before : (i < last ? bytes : after)) += blocks[i].bytes;
+	}
+	if (before > 0 && fseek(fp, (long) before, SEEK_CUR) < 0)
+		failErrno("fseek");
+	std::vector<unsigned char> buf(bytes);
+	if (fread(buf.data(), sizeof(char), bytes, fp) != bytes)
+		failErrno("fread");
+	if (!_decodeBlocks(buf.data(), blocks, first, last, x)) {
+		fail("broken segment data in dump.");
+	}
+	if (after > 0 && fseek(fp, (long) after, SEEK_CUR) < 0)
+		failErrno("fseek");
+}
+
+template<class T>
+void TopicModel<T>::_skipBlocks(FILE *fp,
+		const std::vector<RecordBlock>& blocks) {
+	size_t bytes = 0;
+	for (size_t i = 0; i < blocks.size(); i++)
+		bytes += blocks[i].bytes;
+	if (fseek(fp, (long) bytes, SEEK_CUR) < 0)
+		failErrno("fseek");
+}
+
+/*
+ * Write the records of a segment (after its ID).  In bucketed dumps, the
+ * records are grouped by the bucket of their timestamps (stably, so the
+ * order within a bucket is kept) and indexed.
+ */
+template<class T>
+void TopicModel<T>::_writeBlocks(FILE *fp, const ValueT *x,
+		const int64_t *time, size_t nData) {
+	if (!(_dumpFlags & DUMP_BUCKETED)) {
+		_writeRecords(fp, x, nData);
+		return;
+	}
+	if (time == NULL && nData > 0) {
+		fail("a time-bucketed dump needs timestamps.");
+	}
+	size_t dim = _bytesPerRecord() / sizeof(ValueT);
+	std::vector<size_t> order(nData);
+	for (size_t n = 0; n < nData; n++)
+		order[n] = n;
+	std::stable_sort(order.begin(), order.end(), [&](size_t a, size_t b) {
+		return _bucketOf(time[a]) < _bucketOf(time[b]);
+	});
+
+	std::vector<RecordBlock> blocks;
+	std::vector<unsigned char> data, buf;
+	std::vector<ValueT> xs;
+	for (size_t i = 0; i < nData;) {
+		int64_t b = _bucketOf(time[order[i]]);
+		xs.clear();
+		size_t j = i;
+		for (; j < nData && _bucketOf(time[order[j]]) == b; j++) {
+			xs.insert(xs.end(), x + order[j] * dim, x + (order[j] + 1) * dim);
+		}
+		_encodeRecords(xs.data(), j - i, buf);
+		RecordBlock blk = { b, j - i, buf.size() };
+		blocks.push_back(blk);
+		data.insert(data.end(), buf.begin(), buf.end());
+		i = j;
+	}
+
+	size_t m = blocks.size();
+	if (fwrite(&m, sizeof(size_t), 1, fp) != 1)
+		failErrno("fwrite");
+	for (size_t i = 0; i < m; i++) {
+		if (fwrite(&blocks[i].bucket, sizeof(int64_t), 1, fp) != 1
+				|| fwrite(&blocks[i].nData, sizeof(size_t), 1, fp) != 1
+				|| fwrite(&blocks[i].bytes, sizeof(size_t), 1, fp) != 1)
+			failErrno("fwrite");
+	}
+	if (fwrite(data.data(), sizeof(char), data.size(), fp) != data.size())
+		failErrno("fwrite");
+}
+
+template<class T>
+void TopicModel<T>::_writeRecords(FILE *fp, const ValueT *x, size_t nData) {
+	std::vector<unsigned char> buf;
+	_encodeRecords(x, nData, buf);
+	size_t bytes = buf.size();
+	if ((_dumpFlags & DUMP_PACKED)
+			&& fwrite(&bytes, sizeof(size_t), 1, fp) != 1)
+		failErrno("fwrite");
+	if (fwrite(buf.data(), sizeof(char), bytes, fp) != bytes)
+		failErrno("fwrite");
+}
+
+/* raw records; models supporting DUMP_PACKED override these */
+template<class T>
+void TopicModel<T>::_encodeRecords(const ValueT *x, size_t nData,
+		std::vector<unsigned char>& out) {
+	const unsigned char *p = (const unsigned char *) x;
+	out.assign(p, p + _bytesPerRecord() * nData);
+}
+
+template<class T>
+bool TopicModel<T>::_decodeRecords(const unsigned char *in, size_t bytes,
+		size_t nData, ValueT *x) {
+	if (bytes != _bytesPerRecord() * nData)
+		return false;
+	if (bytes > 0)
+		memcpy(x, in, bytes);
+	return true;
+}
+
+/*
+ * Open a dump file for out-of-core estimation.
+ *
+ * Only the segment headers are read here.  The records are streamed from the
+ * file in every pass of the EM algorithm, and neither they nor their
+ * responsibilities are kept in memory; bufferBytes bounds the memory used
+ * for I/O buffers.
+ */
+template<class T>
+void TopicModel<T>::openDataStream(const char *path, size_t bufferBytes) {
+	_clearSegments();
+	_ids.clear();
+	FILE *fp = fopen(path, "rb");
+	if (fp == NULL)
+		failErrno("fopen");
+	size_t s = _readDumpHeader(fp);
+	if (_dumpFlags & DUMP_CHUNKED) {
+		fclose(fp);
+		fail(path, ": out-of-core estimation needs a compacted dump (csv2dump --compact).");
+	}
+	size_t begin, end;
+	_shardRange(s, begin, end);
+	_stream = new DumpStream(fp, bufferBytes);
+
+	for (size_t i = 0; i < s; i++) {
+		if (i < begin || i >= end) {
+			_skipSegmentInDump(fp);
+			continue;
+		}
+		size_t nData, nId;
+		if (fread(&nData, sizeof(size_t), 1, fp) != 1)
+			failErrno("fread");
+		if (fread(&nId, sizeof(size_t), 1, fp) != 1)
+			failErrno("fread");
+		std::string id(nId, '\0');
+		if (nId > 0 && fread(&id[0], sizeof(char), nId, fp) != nId)
+			failErrno("fread");
+		std::vector<RecordBlock> blocks;
+		_readBlockIndex(fp, nData, blocks);
+		size_t first, last;
+		size_t nSel = _selectBlocks(blocks, first, last);
+		if (nSel >= _nThres) {
+			T *seg = new T(_ids.insert(id.data(), nId));
+			_initLatentParams(seg);
+			_segments.push_back(seg);
+			long offset = ftell(fp);
+			size_t bytes = 0;
+			for (size_t b = 0; b < blocks.size(); b++) {
+				if (b < first)
+					offset += (long) blocks[b].bytes;
+				else if (b < last)
+					bytes += blocks[b].bytes;
+			}
+			_stream->addSegment(nSel, offset, bytes);
+			_streamBlocks.push_back(
+					std::vector<RecordBlock>(blocks.begin() + first,
+							blocks.begin() + last));
+		}
+		_skipBlocks(fp, blocks);
+	}
+}
+
+template<class T>
+void TopicModel<T>::saveDataDump(const char *path) {
+	FILE *fp = fopen(path, "wb");
+	if (fp == NULL)
+		failErrno("fopen");
+	size_t nSegs = _segments.size();
+	DumpStats stats;
+	if (_dumpFlags & DUMP_STATS)
+		_computeDumpStats(stats);
+	_writeDumpHeader(fp, _dumpFlags, nSegs, stats);
+	for (size_t s = 0; s < nSegs; s++) {
+		if (!_saveSegmentDataToDump(fp, _segments[s])) {
+			fail("failed dumping segment data.");
+		}
+	}
+	if (fclose(fp) != 0)
+		failErrno("fclose");
+}
+
+/* the header of a dump with the given flags (stats only for DUMP_STATS) */
+template<class T>
+void TopicModel<T>::_writeDumpHeader(FILE *fp, size_t flags, size_t nSegs,
+		const DumpStats& stats) {
+	if (flags != 0) {
+		size_t magic = PMM_DUMP_MAGIC;
+		if (fwrite(&magic, sizeof(size_t), 1, fp) != 1)
+			failErrno("fwrite");
+		if (fwrite(&flags, sizeof(size_t), 1, fp) != 1)
+			failErrno("fwrite");
+		if ((flags & DUMP_BUCKETED)
+				&& fwrite(&_bucketWidth, sizeof(size_t), 1, fp) != 1)
+			failErrno("fwrite");
+	}
+	if (fwrite(&_D, sizeof(size_t), 1, fp) != 1)
+		failErrno("fwrite");
+	if (fwrite(&_valueSize, sizeof(size_t), 1, fp) != 1)
+		failErrno("fwrite");
+	if (fwrite(&nSegs, sizeof(size_t), 1, fp) != 1)
+		failErrno("fwrite");
+	if (flags & DUMP_STATS)
+		_writeDumpStats(fp, stats);
+}
+
+/*
+ * Append the loaded segments to an existing dump as a new chunk, so that
+ * the cost depends on the new records only.  The dump must have been
+ * written with the same flags (packed, bucket width), which must be set
+ * before reading the records.  A dump without a header (no flags at all)
+ * is rewritten once to get one.  If writing fails, the dump is truncated
+ * to its previous size.
+ */
+template<class T>
+void TopicModel<T>::appendDataDump(const char *path) {
+	size_t flags = _dumpFlags, width = _bucketWidth;
+	FILE *fp = fopen(path, "r+b");
+	if (fp == NULL)
+		failErrno(path);
+	size_t magic = 0;
+	if (fread(&magic, sizeof(size_t), 1, fp) != 1) {
+		fclose(fp);
+		fail(path, ": not a dump file");
+	}
+	if (magic != PMM_DUMP_MAGIC) {
+		fclose(fp);
+		if ((flags & ~(size_t) DUMP_STATS) != 0)
+			fail(path, ": the dump was written with other options (-p, --bucket).");
+		_rewriteDump(path, true);
+		fp = fopen(path, "r+b");
+		if (fp == NULL)
+			failErrno(path);
+	}
+	rewind(fp);
+	try {
+		_readDumpHeader(fp);
+		size_t ignored = DUMP_CHUNKED | DUMP_STATS;
+		if ((_dumpFlags & ~ignored) != (flags & ~ignored)
+				|| ((flags & DUMP_BUCKETED) && _bucketWidth != width))
+			fail(path, ": the dump was written with other options (-p, --bucket).");
+	} catch (...) {
+		fclose(fp);
+		throw;
+	}
+
+	if (fseek(fp, 0, SEEK_END) < 0) {
+		fclose(fp);
+		failErrno("fseek");
+	}
+	long size = ftell(fp);
+	try {
+		size_t nSegs = _segments.size();
+		if (fwrite(&nSegs, sizeof(size_t), 1, fp) != 1)
+			failErrno("fwrite");
+		for (size_t s = 0; s < nSegs; s++) {
+			if (!_saveSegmentDataToDump(fp, _segments[s])) {
+				fail("failed dumping segment data.");
+			}
+		}
+		if (fflush(fp) != 0)
+			failErrno("fflush");
+		/* mark the dump as chunked once the chunk is complete */
+		if (!(_dumpFlags & DUMP_CHUNKED)) {
+			_dumpFlags |= DUMP_CHUNKED;
+			if (fseek(fp, sizeof(size_t), SEEK_SET) < 0
+					|| fwrite(&_dumpFlags, sizeof(size_t), 1, fp) != 1)
+				failErrno("fwrite");
+		}
+		/* the statistics no longer describe the data (see _readDumpStats()) */
+		if ((_dumpFlags & DUMP_STATS) && _dumpStats.valid) {
+			size_t stale = 0;
+			long pos = (long) ((_dumpFlags & DUMP_BUCKETED) ? 7 : 6)
+					* (long) sizeof(size_t);
+			if (fseek(fp, pos, SEEK_SET) < 0
+					|| fwrite(&stale, sizeof(size_t), 1, fp) != 1)
+				failErrno("fwrite");
+		}
+	} catch (...) {
+		fflush(fp);
+		if (ftruncate(fileno(fp), size) != 0)
+			perror("ftruncate");
+		fclose(fp);
+		throw;
+	}
+	if (fclose(fp) != 0)
+		failErrno("fclose");
+}
+
+/*
+ * Rewrite a chunked dump with all records of each segment ID in one place,
+ * which makes it loadable faster and out of core again.
+ */
+template<class T>
+void TopicModel<T>::compactDataDump(const char *path) {
+	_rewriteDump(path, false);
+}
+
+/*
+ * Rewrite a dump as a single chunk, with the segments in order of first
+ * appearance and the records of all chunks merged.  The result is written
+ * next to the dump and renamed.  The flags are kept except DUMP_CHUNKED,
+ * which is set if chunked is true.
+ */
+template<class T>
+void TopicModel<T>::_rewriteDump(const char *path, bool chunked) {
+	FILE *in = fopen(path, "rb");
+	if (in == NULL)
+		failErrno(path);
+	std::string tmp = std::string(path) + ".tmp";
+	size_t dim = _bytesPerRecord() / sizeof(ValueT);
+	FILE *out = NULL;
+	try {
+		size_t s = _readDumpHeader(in);
+		SegmentIdTable ids;
+		std::vector<std::vector<DumpPiece>> pieces;
+		_scanChunks(in, s, ids, pieces);
+		size_t flags = (_dumpFlags & ~(size_t) DUMP_CHUNKED) | DUMP_STATS;
+		if (chunked)
+			flags |= DUMP_CHUNKED;
+
+		/* the sizes are known from the index; the value range follows */
+		DumpStats stats;
+		std::vector<size_t> sizes(ids.size(), 0);
+		for (size_t i = 0; i < ids.size(); i++) {
+			for (const DumpPiece& p : pieces[i])
+				for (const RecordBlock& b : p.blocks)
+					sizes[i] += b.nData;
+		}
+		std::sort(sizes.begin(), sizes.end());
+		stats.valid = true;
+		stats.nRecords = 0;
+		for (size_t n : sizes) {
+			if (stats.sizes.empty() || stats.sizes.back().first != n)
+				stats.sizes.push_back(std::make_pair(n, (size_t) 0));
+			++stats.sizes.back().second;
+			stats.nRecords += n;
+		}
+		stats.valueMin.assign(dim, 0.0);
+		stats.valueMax.assign(dim, 0.0);
+
+		out = fopen(tmp.c_str(), "wb");
+		if (out == NULL)
+			failErrno(tmp.c_str());
+		_writeDumpHeader(out, flags, ids.size(), stats);
+		long rangePos = ftell(out) - (long) (2 * dim * sizeof(double));
+		std::vector<RecordBlock> blocks;
+		std::vector<ValueT> x;
+		std::vector<int64_t> time;
+		bool first = true;
+		for (size_t i = 0; i < ids.size(); i++) {
+			_mergePieces(in, pieces[i], blocks, x);
+			for (size_t j = 0; j < x.size(); j++) {
+				size_t d = j % dim;
+				double v = (double) x[j];
+				if (first || v < stats.valueMin[d])
+					stats.valueMin[d] = v;
+				if (first || v > stats.valueMax[d])
+					stats.valueMax[d] = v;
+				first = first && d + 1 < dim;
+			}
+			/* bucket starts as timestamps, so that the blocks are kept */
+			time.clear();
+			for (const RecordBlock& b : blocks)
+				time.insert(time.end(), b.nData,
+						b.bucket * (int64_t) _bucketWidth);
+			size_t nData = time.size(), len = ids.length(i);
+			if (fwrite(&nData, sizeof(size_t), 1, out) != 1
+					|| fwrite(&len, sizeof(size_t), 1, out) != 1
+					|| fwrite(ids.str(i), sizeof(char), len, out) != len)
+				failErrno("fwrite");
+			_writeBlocks(out, x.data(), time.data(), nData);
+		}
+		if (fseek(out, rangePos, SEEK_SET) < 0
+				|| fwrite(stats.valueMin.data(), sizeof(double), dim, out) != dim
+				|| fwrite(stats.valueMax.data(), sizeof(double), dim, out) != dim)
+			failErrno("fwrite");
+		if (fclose(out) != 0) {
+			out = NULL;
+			failErrno("fclose");
+		}
+		out = NULL;
+	} catch (...) {
+		fclose(in);
+		if (out != NULL)
+			fclose(out);
+		unlink(tmp.c_str());
+		throw;
+	}
+	fclose(in);
+	if (rename(tmp.c_str(), path) != 0)
+		failErrno("rename");
+}
+
+/*
+ * Read the segment headers of all chunks of a dump whose first number of
+ * segments s has just been read, and collect where the records of each ID
+ * are.  IDs get indexes in ids in order of first appearance.
+ */
+template<class T>
+void TopicModel<T>::_scanChunks(FILE *fp, size_t s, SegmentIdTable& ids,
+		std::vector<std::vector<DumpPiece>>& pieces) {
+	std::string id;
+	for (;;) {
+		for (size_t i = 0; i < s; i++) {
+			size_t nData, nId;
+			if (fread(&nData, sizeof(size_t), 1, fp) != 1
+					|| fread(&nId, sizeof(size_t), 1, fp) != 1)
+				failErrno("fread");
+			id.resize(nId);
+			if (nId > 0 && fread(&id[0], sizeof(char), nId, fp) != nId)
+				failErrno("fread");
+			DumpPiece p;
+			_readBlockIndex(fp, nData, p.blocks);
+			p.offset = ftell(fp);
+			_skipBlocks(fp, p.blocks);
+			size_t j = ids.insert(id.data(), nId);
+			if (j >= pieces.size())
+				pieces.resize(j + 1);
+			pieces[j].push_back(std::move(p));
+		}
+		if (!(_dumpFlags & DUMP_CHUNKED)
+				|| fread(&s, sizeof(size_t), 1, fp) != 1)
+			break;
+	}
+	if (ferror(fp))
+		failErrno("fread");
+}
+
+/*
+ * Read and decode the records of one segment from its pieces.  Blocks of
+ * the same bucket are joined, records of earlier chunks first, so blocks
+ * has one entry per bucket (a single one if not bucketed), and x holds the
+ * records in block order.  The sizes in blocks are those of the pieces.
+ */
+template<class T>
+void TopicModel<T>::_mergePieces(FILE *fp, const std::vector<DumpPiece>& pieces,
+		std::vector<RecordBlock>& blocks, std::vector<ValueT>& x) {
+	size_t dim = _bytesPerRecord() / sizeof(ValueT);
+	std::vector<RecordBlock> all;
+	std::vector<std::vector<ValueT>> values;
+	for (const DumpPiece& p : pieces) {
+		if (fseek(fp, p.offset, SEEK_SET) < 0)
+			failErrno("fseek");
+		for (const RecordBlock& b : p.blocks) {
+			std::vector<unsigned char> buf(b.bytes);
+			if (b.bytes > 0 && fread(buf.data(), sizeof(char), b.bytes, fp) != b.bytes)
+				failErrno("fread");
+			values.emplace_back(b.nData * dim);
+			if (!_decodeRecords(buf.data(), b.bytes, b.nData, values.back().data()))
+				fail("broken segment data in dump.");
+			all.push_back(b);
+		}
+	}
+	std::vector<size_t> order(all.size());
+	for (size_t i = 0; i < order.size(); i++)
+		order[i] = i;
+	if (_dumpFlags & DUMP_BUCKETED) {
+		std::stable_sort(order.begin(), order.end(), [&](size_t a, size_t b) {
+			return all[a].bucket < all[b].bucket;
+		});
+	}
+	blocks.clear();
+	x.clear();
+	for (size_t i : order) {
+		if (blocks.empty() || blocks.back().bucket != all[i].bucket) {
+			blocks.push_back(all[i]);
+		} else {
+			blocks.back().nData += all[i].nData;
+			blocks.back().bytes += all[i].bytes;
+		}
+		x.insert(x.end(), values[i].begin(), values[i].end());
+	}
+}
+
+/* loadDataDump() for DUMP_CHUNKED dumps; shards split the merged IDs */
+template<class T>
+void TopicModel<T>::_loadChunkedDump(FILE *fp, size_t s) {
+	SegmentIdTable ids;
+	std::vector<std::vector<DumpPiece>> pieces;
+	_scanChunks(fp, s, ids, pieces);
+	size_t begin, end;
+	_shardRange(ids.size(), begin, end);
+	size_t dim = _bytesPerRecord() / sizeof(ValueT);
+	std::vector<RecordBlock> blocks;
+	std::vector<ValueT> x;
+	for (size_t i = begin; i < end; i++) {
+		_mergePieces(fp, pieces[i], blocks, x);
+		size_t first, last, skipped = 0;
+		size_t nData = _selectBlocks(blocks, first, last);
+		if (nData < _nThres)
+			continue;
+		for (size_t b = 0; b < first; b++)
+			skipped += blocks[b].nData;
+		T *seg = _newSegment(ids.str(i), ids.length(i), &x[skipped * dim], nData);
+		_segments.push_back(seg);
+	}
+}
+
+/*
+ * Read a time-bucketed dump once and deal its records out to the models of
+ * a bank: of n = models.size() slots of period / n seconds, records at time
+ * t go to models[(t mod period) / (period / n)], e.g. by hour of week.  The
+ * time range of this model applies; each model keeps its own threshold.
+ * A bucket must lie within one slot.
+ */
+template<class T>
+void TopicModel<T>::splitDataDump(FILE *fp, int64_t period,
+		const std::vector<TopicModel<T>*>& models) {
+	size_t n = models.size();
+	rewind(fp);
+	size_t s = _readDumpHeader(fp);
+	if (!(_dumpFlags & DUMP_BUCKETED)) {
+		fail("a model bank needs a time-bucketed dump (csv2dump --bucket).");
+	}
+	if (n == 0 || period <= 0 || period % (int64_t) n != 0) {
+		fail("the period (", period, "s) must be a multiple of the number of slots.");
+	}
+	int64_t width = period / (int64_t) n;
+	if (width % (int64_t) _bucketWidth != 0) {
+		fail("slots of ", width, "s are not a multiple of the bucket width (",
+				_bucketWidth, "s).");
+	}
+	for (TopicModel<T> *m : models) {
+		m->_clearSegments();
+		m->_ids.clear();
+	}
+
+	SegmentIdTable ids;
+	std::vector<std::vector<DumpPiece>> pieces;
+	_scanChunks(fp, s, ids, pieces);
+	size_t dim = _bytesPerRecord() / sizeof(ValueT);
+	std::vector<RecordBlock> blocks;
+	std::vector<ValueT> x;
+	std::vector<std::vector<ValueT>> parts(n); /* records of each slot */
+	for (size_t i = 0; i < ids.size(); i++) {
+		_mergePieces(fp, pieces[i], blocks, x);
+		size_t first, last, offset = 0;
+		_selectBlocks(blocks, first, last);
+		for (std::vector<ValueT>& p : parts)
+			p.clear();
+		for (size_t b = 0; b < blocks.size(); b++) {
+			size_t len = blocks[b].nData * dim;
+			if (first <= b && b < last) {
+				int64_t t = blocks[b].bucket * (int64_t) _bucketWidth % period;
+				std::vector<ValueT>& p = parts[((t < 0) ? t + period : t) / width];
+				p.insert(p.end(), x.begin() + offset, x.begin() + offset + len);
+			}
+			offset += len;
+		}
+		for (size_t j = 0; j < n; j++) {
+			size_t nData = parts[j].size() / dim;
+			if (nData == 0 || nData < models[j]->_nThres)
+				continue;
+			models[j]->_segments.push_back(models[j]->_newSegment(ids.str(i),
+					ids.length(i), parts[j].data(), nData));
+		}
+	}
+}
+
+/* a new segment with the given ID and records, ready for estimation */
+template<class T>
+T* TopicModel<T>::_newSegment(const char *id, size_t len, const ValueT *x,
+		size_t nData) {
+	size_t dim = _bytesPerRecord() / sizeof(ValueT);
+	T *seg = new T(_ids.insert(id, len));
+	seg->data.reserve(nData);
+	for (size_t j = 0; j < nData; j++) {
+		std::valarray<ValueT> v(x + j * dim, dim);
+		ObservedValue<std::valarray<ValueT>> ov(v);
+		seg->data.push_back(ov);
+	}
+	_initLatentParams(seg);
+	return seg;
+}
+
+/*
+ * Add n records from memory: record i of segment ids[i] is x[i * D ..].
+ * The first call after finishRecords() (or after construction) replaces the
+ * data set; finishRecords() must be called before estimation.
+ */
+template<class T>
+void TopicModel<T>::addRecords(const char * const *ids, const ValueT *x,
+		size_t n) {
+	if (n == 0)
+		return;
+	if (_pending.empty()) {
+		_clearSegments();
+		_ids.clear();
+	}
+	size_t dim = _bytesPerRecord() / sizeof(ValueT);
+	for (size_t i = 0; i < n; i++) {
+		T *seg = _searchSegment(_pending, _ids, ids[i], strlen(ids[i]),
+				true);
+		std::valarray<ValueT> v(x + i * dim, dim);
+		ObservedValue<std::valarray<ValueT>> ov(v);
+		seg->addData(ov);
+	}
+}
+
+template<class T>
+void TopicModel<T>::finishRecords(void) {
+	if (_pending.empty())
+		return;
+	_hash2list(_pending);
+	_pending.clear();
+}
+
+template<class T>
+T* TopicModel<T>::_searchSegment(std::vector<T*>& table, SegmentIdTable& ids,
+		const char *id, size_t len, bool forceadd) {
+	size_t i = forceadd ? ids.insert(id, len) : ids.find(id, len);
+	if (i == SegmentIdTable::npos)
+		return NULL;
+	if (i >= table.size())
+		table.resize(i + 1, NULL);
+	if (table[i] == NULL && forceadd) {
+		/* not found and force add */
+		table[i] = new T(i);
+	}
+	return table[i];
+}
+
+template<class T>
+size_t TopicModel<T>::_segmentSize(size_t s) {
+	if (_stream != NULL)
+		return _stream->nData(s);
+	if (!_remoteSizes.empty())
+		return _remoteSizes[s];
+	return _segments[s]->data.size();
+}
+
+/*
+ * Copy the records of segment s into x, one record after another.
+ * Out of core, the segment must belong to the current chunk.
+ */
+template<class T>
+void TopicModel<T>::_segmentRecords(size_t s, std::vector<ValueT>& x) {
+	size_t dim = _bytesPerRecord() / sizeof(ValueT);
+	size_t nData = _segmentSize(s);
+	x.resize(nData * dim);
+	if (_stream != NULL) {
+		const std::vector<RecordBlock>& blocks = _streamBlocks[s];
+		if (!_decodeBlocks((const unsigned char *) _stream->segmentData(s),
+				blocks, 0, blocks.size(), x.data())) {
+			fail("broken segment data in dump.");
+		}
+		return;
+	}
+	T *seg = _segments[s];
+	for (size_t n = 0; n < nData; n++) {
+		for (size_t d = 0; d < dim; d++) {
+			x[n * dim + d] = seg->data[n].value[d];
+		}
+	}
+}
+
+/*
+ * Call f(s, x, nData) for every segment s with its records x, in parallel
+ * and whether the records are in memory or streamed.
+ */
+template<class T>
+template<class F>
+void TopicModel<T>::_forEachSegment(F f) {
+	size_t first = 0, last = _segments.size(), i;
+	if (_stream != NULL)
+		_stream->beginPass();
+	while (_stream == NULL || _stream->nextChunk(first, last)) {
+		ParallelErrors errors;
+#ifdef _OPENMP
+#pragma omp parallel for schedule(dynamic)
+#endif
+		for (i = first; i < last; i++) {
+			errors.run([&] {
+				std::vector<ValueT> x;
+				_segmentRecords(i, x);
+				f(i, x.data(), _segmentSize(i));
+			});
+		}
+		errors.rethrow();
+		if (_stream == NULL)
+			return;
+	}
+	_stream->endPass();
+}
+
+/*
+ * Data-driven initialization of the distribution parameters, replacing the
+ * random ones set by the constructor.  method is one of
+ *   "uniform":  keep the random parameters,
+ *   "quantile": component k gets the (k + 1/2)/K quantile of each dimension,
+ *   "kmeans":   k-means++ on the per-segment means, weighted by size.
+ * Both take a single pass over the loaded (or streamed) data.
+ */
+template<class T>
+void TopicModel<T>::initDistParams(const std::string& method) {
+	std::vector<double> centers;
+	if (method == "uniform") {
+		return;
+	} else if (method == "quantile") {
+		_quantileCenters(centers);
+	} else if (method == "kmeans") {
+		_kmeansCenters(centers);
+	} else {
+		fail("unknown initialization: ", method);
+	}
+	_initDistParamsFromCenters(centers.data());
+}
+
+template<class T>
+void TopicModel<T>::_quantileCenters(std::vector<double>& centers) {
+	const size_t maxSample = 1 << 20;
+	size_t dim = _bytesPerRecord() / sizeof(ValueT);
+	size_t nSegs = _segments.size();
+
+	/* take every step-th record */
+	std::vector<size_t> offset(nSegs + 1, 0);
+	for (size_t s = 0; s < nSegs; s++) {
+		offset[s + 1] = offset[s] + _segmentSize(s);
+	}
+	size_t step = (offset[nSegs] + maxSample - 1) / maxSample;
+	if (step == 0)
+		step = 1;
+	size_t m = (offset[nSegs] + step - 1) / step;
+	std::vector<double> sample(m * dim);
+	_forEachSegment([&](size_t s, const ValueT *x, size_t nData) {
+		size_t g = (offset[s] + step - 1) / step * step;
+		for (; g < offset[s] + nData; g += step) {
+			for (size_t d = 0; d < dim; d++) {
+				sample[(g / step) * dim + d] =
+						(double) x[(g - offset[s]) * dim + d];
+			}
+		}
+	});
+
+	centers.assign(_K * dim, 0.0);
+	std::vector<double> v(m);
+	for (size_t d = 0; d < dim && m > 0; d++) {
+		for (size_t j = 0; j < m; j++) {
+			v[j] = sample[j * dim + d];
+		}
+		std::sort(v.begin(), v.end());
+		for (size_t k = 0; k < _K; k++) {
+			size_t j = std::min(m - 1, (size_t) ((k + 0.5) / _K * m));
+			double c = v[j];
+			/* identical components would never separate */
+			if (k > 0 && c <= centers[(k - 1) * dim + d])
+				c = centers[(k - 1) * dim + d] * 1.01 + 0.01;
+			centers[k * dim + d] = c;
+		}
+	}
+}
+
+template<class T>
+void TopicModel<T>::_kmeansCenters(std::vector<double>& centers) {
+	size_t dim = _bytesPerRecord() / sizeof(ValueT);
+	size_t nSegs = _segments.size();
+
+	/* per-segment means */
+	std::vector<double> means(nSegs * dim, 0.0), weight(nSegs);
+	_forEachSegment([&](size_t s, const ValueT *x, size_t nData) {
+		for (size_t n = 0; n < nData; n++) {
+			for (size_t d = 0; d < dim; d++) {
+				means[s * dim + d] += (double) x[n * dim + d];
+			}
+		}
+		for (size_t d = 0; d < dim && nData > 0; d++) {
+			means[s * dim + d] /= (double) nData;
+		}
+		weight[s] = (double) nData;
+	});
+
+	/* k-means++ seeding */
+	centers.assign(_K * dim, 0.0);
+	std::vector<double> dist(nSegs, DBL_MAX);
+	std::vector<size_t> assign(nSegs, 0);
+	for (size_t k = 0; k < _K && nSegs > 0; k++) {
+		std::vector<double> w(nSegs);
+		double wsum = 0.0;
+		for (size_t s = 0; s < nSegs; s++) {
+			w[s] = (k == 0) ? weight[s] : weight[s] * dist[s];
+			wsum += w[s];
+		}
+		if (wsum == 0.0) /* all means coincide */
+			w = weight;
+		std::discrete_distribution<size_t> pick(w.begin(), w.end());
+		size_t c = pick(_rng);
+		for (size_t d = 0; d < dim; d++) {
+			centers[k * dim + d] = means[c * dim + d];
+		}
+		for (size_t s = 0; s < nSegs; s++) {
+			double e = 0.0;
+			for (size_t d = 0; d < dim; d++) {
+				double diff = means[s * dim + d] - centers[k * dim + d];
+				e += diff * diff;
+			}
+			if (e < dist[s]) {
+				dist[s] = e;
+				assign[s] = k;
+			}
+		}
+	}
+
+	/* a few weighted Lloyd iterations */
+	for (size_t itr = 0; itr < 10 && nSegs > 0; itr++) {
+		std::vector<double> sum(_K * dim, 0.0), total(_K, 0.0);
+		for (size_t s = 0; s < nSegs; s++) {
+			total[assign[s]] += weight[s];
+			for (size_t d = 0; d < dim; d++) {
+				sum[assign[s] * dim + d] += weight[s] * means[s * dim + d];
+			}
+		}
+		for (size_t k = 0; k < _K; k++) {
+			for (size_t d = 0; d < dim && total[k] > 0.0; d++) {
+				centers[k * dim + d] = sum[k * dim + d] / total[k];
+			}
+		}
+		for (size_t s = 0; s < nSegs; s++) {
+			double best = DBL_MAX;
+			for (size_t k = 0; k < _K; k++) {
+				double e = 0.0;
+				for (size_t d = 0; d < dim; d++) {
+					double diff = means[s * dim + d] - centers[k * dim + d];
+					e += diff * diff;
+				}
+				if (e < best) {
+					best = e;
+					assign[s] = k;
+				}
+			}
+		}
+	}
+}
+
+template<class T>
+size_t TopicModel<T>::numberOfSegments(void) {
+	return _segments.size();
+}
+
+template<class T>
+const char* TopicModel<T>::segmentId(size_t s) {
+	return _ids.str(_segments[s]->getId());
+}
+
+/* index of the segment with the given ID, or SegmentIdTable::npos */
+template<class T>
+size_t TopicModel<T>::findSegment(const char *id, size_t len) {
+	if (_segmentOfId.size() != _ids.size()) {
+		_segmentOfId.assign(_ids.size(), SegmentIdTable::npos);
+		for (size_t s = 0; s < _segments.size(); s++)
+			_segmentOfId[_segments[s]->getId()] = s;
+	}
+	size_t i = _ids.find(id, len);
+	return (i == SegmentIdTable::npos) ? i : _segmentOfId[i];
+}
+
+template<class T>
+void TopicModel<T>::getTheta(size_t s, double *theta) {
+	for (size_t k = 0; k < _K; k++)
+		theta[k] = _segments[s]->theta[k];
+}
+
+template<class T>
+size_t TopicModel<T>::numberOfDistParams(void) {
+	return _numberOfDistParams();
+}
+
+template<class T>
+void TopicModel<T>::getDistParams(double *params) {
+	_getDistParams(params);
+}
+
+/*
+ * Log-likelihood of record x under the mixing coefficients of segment s
+ * (uniform ones if s is not a segment).  Unless gamma is NULL, the
+ * responsibilities of the K components are stored there.
+ */
+template<class T>
+double TopicModel<T>::scoreRecord(size_t s, const ValueT *x, double *gamma) {
+	std::valarray<double> g(_K);
+	for (size_t k = 0; k < _K; k++) {
+		double theta = (s < _segments.size()) ?
+				_segments[s]->theta[k] : 1.0 / (double) _K;
+		g[k] = theta * _pdfOfRecord(x, k);
+	}
+	double total = g.sum();
+	if (gamma != NULL) {
+		for (size_t k = 0; k < _K; k++)
+			gamma[k] = (total > 0.0) ? g[k] / total : 1.0 / (double) _K;
+	}
+	return gsl_sf_log(total > 0.0 ? total : DBL_MIN);
+}
+
+/* FNV-1a over the segment IDs in order, to recognize the data set */
+template<class T>
+size_t TopicModel<T>::_idHash(void) {
+	uint64_t h = 14695981039346656037ULL;
+	for (size_t s = 0; s < _segments.size(); s++) {
+		size_t id = _segments[s]->getId();
+		const char *p = _ids.str(id);
+		for (size_t i = 0; i <= _ids.length(id); i++) {
+			h = (h ^ (unsigned char) (i < _ids.length(id) ? p[i] : ',')) * 1099511628211ULL;
+		}
+	}
+	return (size_t) h;
+}
+
+/*
+ * Store the model state in c: the distribution parameters, theta of every
+ * segment, the RNG, and the lazy EM caches if they are in use.  Pruned
+ * components need not be stored; their theta is zero.
+ */
+template<class T>
+void TopicModel<T>::saveCheckpoint(Checkpoint& c) {
+	if (!_shards.empty())
+		fail("checkpoints are not supported with shards.");
+	c.K = _K;
+	c.D = _D;
+	c.nSegments = _segments.size();
+	c.idHash = _idHash();
+	std::ostringstream os;
+	os << _rng;
+	c.rng = os.str();
+	c.nLazyItr = _nLazyItr;
+	c.nSparseItr = _nSparseItr;
+	c.nMiniBatchItr = _nMiniBatchItr;
+	c.batchStats = _batchStats;
+	c.params.resize(_numberOfDistParams());
+	_getDistParams(c.params.data());
+	c.theta.resize(_segments.size() * _K);
+	for (size_t s = 0; s < _segments.size(); s++)
+		getTheta(s, &c.theta[s * _K]);
+	if (_lazyTol > 0.0 && !_segStats.empty()) {
+		c.lazyParams = _lazyParams;
+		c.segParamsAt = _segParamsAt;
+		c.segStats = _segStats;
+		c.thetaChange = _thetaChange;
+	} else {
+		c.lazyParams.clear();
+		c.segParamsAt.clear();
+		c.segStats.clear();
+		c.thetaChange.clear();
+	}
+}
+
+/* continue from a state stored by saveCheckpoint() for the same data set */
+template<class T>
+void TopicModel<T>::restoreCheckpoint(const Checkpoint& c) {
+	if (!_shards.empty())
+		fail("checkpoints are not supported with shards.");
+	if (c.K != _K || c.D != _D)
+		fail("the checkpoint is for K = ", c.K, ", D = ", c.D, ".");
+	if (c.nSegments != _segments.size() || c.idHash != _idHash()
+			|| c.params.size() != _numberOfDistParams())
+		fail("the checkpoint is for another data set.");
+	std::istringstream is(c.rng);
+	is >> _rng;
+	_nLazyItr = c.nLazyItr;
+	_nSparseItr = c.nSparseItr;
+	_nMiniBatchItr = c.nMiniBatchItr;
+	_batchStats = c.batchStats;
+	_setDistParams(c.params.data());
+	for (size_t s = 0; s < _segments.size(); s++) {
+		T *seg = _segments[s];
+		seg->theta = std::valarray<double>(&c.theta[s * _K], _K);
+		seg->active.clear();
+		for (size_t k = 0; _sparseEps > 0.0 && k < _K; k++) {
+			if (seg->theta[k] != 0.0)
+				seg->active.push_back(k);
+		}
+		if (seg->active.size() == _K)
+			seg->active.clear();
+	}
+	if (!c.segStats.empty()) {
+		for (size_t at : c.segParamsAt) {
+			if ((at + 1) * c.params.size() > c.lazyParams.size())
+				fail("the checkpoint is inconsistent.");
+		}
+		_lazyParams = c.lazyParams;
+		_segParamsAt = c.segParamsAt;
+		_segStats = c.segStats;
+		_thetaChange = c.thetaChange;
+	}
+}
+
+/*
+ * The statistics of the dump header are used when they describe the loaded
+ * segments, i.e. all segments of the dump above the size threshold;
+ * otherwise the sizes are collected from the segments.
+ */
+template<class T>
+void TopicModel<T>::printDataStats(void) {
+	size_t _S = _segments.size();
+	std::vector<std::pair<size_t, size_t>> sizes;
+	bool fromHeader = _dumpStats.valid && !_hasTimeRange() && _nShards == 1;
+	if (fromHeader) {
+		size_t c = 0;
+		for (const auto& p : _dumpStats.sizes) {
+			if (p.first >= _nThres) {
+				sizes.push_back(p);
+				c += p.second;
+			}
+		}
+		fromHeader = (c == _S);
+	}
+	if (!fromHeader) {
+		std::vector<size_t> vec(_S);
+		for (size_t s = 0; s < _S; s++)
+			vec[s] = _segmentSize(s);
+		std::sort(vec.begin(), vec.end());
+		sizes.clear();
+		for (size_t s = 0; s < _S; s++) {
+			if (sizes.empty() || sizes.back().first != vec[s])
+				sizes.push_back(std::make_pair(vec[s], (size_t) 0));
+			++sizes.back().second;
+		}
+	}
+	_printSizeStats(sizes);
+	if (fromHeader) {
+		for (size_t d = 0; d < _dumpStats.valueMin.size(); d++) {
+			std::cerr << "value-range[" << d << "] = " << _dumpStats.valueMin[d]
+					<< " .. " << _dumpStats.valueMax[d] << std::endl;
+		}
+	}
+}
+
+/* print the statistics of the segment sizes, given as (size, count) */
+template<class T>
+void TopicModel<T>::_printSizeStats(
+		const std::vector<std::pair<size_t, size_t>>& sizes) {
+	size_t n = 0, _S = 0;
+	for (const auto& p : sizes) {
+		n += p.first * p.second;
+		_S += p.second;
+	}
+	std::cerr << "total " << _S << " segments" << std::endl;
+	std::cerr << "using " << n << " records" << std::endl;
+
+	/* the i-th smallest size */
+	auto nth = [&](size_t i) {
+		for (const auto& p : sizes) {
+			if (i < p.second)
+				return p.first;
+			i -= p.second;
+		}
+		return (size_t) 0;
+	};
+	double mean = (double) n / (double) _S;
+	double var = 0.0;
+	for (const auto& p : sizes) {
+		double d = (double) p.first - mean;
+		var += d * d * (double) p.second;
+	}
+	var /= (double) _S;
+	std::cerr << "n_data-mean = " << mean << ", n_data-variance = " << var
+			<< std::endl;
+	std::cerr << "n_data-min = " << nth(0) << ", n_data-max = " << nth(_S - 1)
+			<< std::endl;
+	std::cerr << "n_data-quantile: " << nth(_S / 4) << ", " << nth(_S / 2)
+			<< ", " << nth(_S / 4 * 3) << std::endl;
+}
+
+template<class T>
+void TopicModel<T>::dump(void) {
+	std::cout << "# of Mixture : " << _K << std::endl;
+	std::cout << "Dimension : " << _D << std::endl;
+
+	_dumpTopicParamsAndSegments();
+}
+
+/*
+ * Write the mixing coefficients of all segments, the k-th printed
+ * component being order[k]: "id,Ns,theta1,..." rows (or "id,Ns,k:theta,..."
+ * in sparse mode) to stdout, or the binary matrix if setThetaOutput() was
+ * called.  Blocks of rows are formatted in parallel into their own buffers
+ * and written in order, a batch of blocks at a time.
+ */
+template<class T>
+void TopicModel<T>::_writeSegments(const size_t *order) {
+	if (!_thetaPath.empty()) {
+		_writeThetaBinary(order);
+		return;
+	}
+	if (_sparseEps > 0.0) {
+		printf("id,Ns,k:theta,...\n");
+	} else {
+		printf("id,Ns,theta1,theta2,...\n");
+	}
+
+	const size_t rowsPerBlock = 4096, blocksPerBatch = 64;
+	size_t nSegs = _segments.size();
+	std::vector<std::string> blocks(blocksPerBatch);
+	for (size_t first = 0; first < nSegs; first += rowsPerBlock * blocksPerBatch) {
+		size_t nBlocks = std::min(blocksPerBatch,
+				(nSegs - first + rowsPerBlock - 1) / rowsPerBlock);
+		size_t b;
+#ifdef _OPENMP
+#pragma omp parallel for schedule(dynamic)
+#endif
+		for (b = 0; b < nBlocks; b++) {
+			std::string& out = blocks[b];
+			char num[FORMAT_BUFSIZE];
+			size_t begin = first + b * rowsPerBlock;
+			size_t end = std::min(begin + rowsPerBlock, nSegs);
+			out.clear();
+			for (size_t s = begin; s < end; s++) {
+				T *seg = _segments[s];
+				out.append(_ids.str(seg->getId()), _ids.length(seg->getId()));
+				out += ',';
+				out.append(num, formatSize(num, _segmentSize(s)));
+				for (size_t k = 0; k < _K; k++) {
+					double theta = seg->theta[order[k]];
+					if (_sparseEps <= 0.0) {
+						out += ',';
+						out.append(num, formatExp(num, theta));
+					} else if (theta > 0.0) {
+						out += ',';
+						out.append(num, formatSize(num, k + 1));
+						out += ':';
+						out.append(num, formatExp(num, theta));
+					}
+				}
+				out += '\n';
+			}
+		}
+		for (b = 0; b < nBlocks; b++) {
+			if (fwrite(blocks[b].data(), 1, blocks[b].size(), stdout)
+					!= blocks[b].size())
+				failErrno("fwrite");
+		}
+	}
+	if (fflush(stdout) != 0)
+		failErrno("fflush");
+}
+
+/*
+ * Binary theta file:
+ * sizeof(size_t) bytes: PMM_THETA_MAGIC
+ * sizeof(size_t) bytes: number of segments S
+ * sizeof(size_t) bytes: number of components K
+ * S * K doubles: theta, row by row, components in the printed order
+ * repeat S times {
+ *   sizeof(size_t) bytes: the number of data Ns
+ *   sizeof(size_t) bytes: segment ID string length L
+ *   sizeof(char) * L bytes: segment ID string
+ * }
+ * so that the matrix can be mapped at a fixed offset.
+ */
+template<class T>
+void TopicModel<T>::_writeThetaBinary(const size_t *order) {
+	FILE *fp = fopen(_thetaPath.c_str(), "wb");
+	if (fp == NULL)
+		failErrno(_thetaPath.c_str());
+	try {
+		size_t header[3] = { PMM_THETA_MAGIC, _segments.size(), _K };
+		if (fwrite(header, sizeof(size_t), 3, fp) != 3)
+			failErrno("fwrite");
+		const size_t rowsPerBatch = 1 << 16;
+		std::vector<double> rows;
+		for (size_t first = 0; first < _segments.size(); first += rowsPerBatch) {
+			size_t end = std::min(first + rowsPerBatch, _segments.size());
+			rows.resize((end - first) * _K);
+			for (size_t s = first; s < end; s++) {
+				for (size_t k = 0; k < _K; k++)
+					rows[(s - first) * _K + k] = _segments[s]->theta[order[k]];
+			}
+			if (fwrite(rows.data(), sizeof(double), rows.size(), fp) != rows.size())
+				failErrno("fwrite");
+		}
+		for (size_t s = 0; s < _segments.size(); s++) {
+			size_t id = _segments[s]->getId();
+			size_t entry[2] = { _segmentSize(s), _ids.length(id) };
+			if (fwrite(entry, sizeof(size_t), 2, fp) != 2
+					|| fwrite(_ids.str(id), 1, entry[1], fp) != entry[1])
+				failErrno("fwrite");
+		}
+	} catch (...) {
+		fclose(fp);
+		throw;
+	}
+	if (fclose(fp) != 0)
+		failErrno("fclose");
+}
+
+/* adds the seconds of its lifetime to a PhaseTimes member */
+class PhaseTimer {
+private:
+	double& _seconds;
+	std::chrono::steady_clock::time_point _start;
+
+public:
+	PhaseTimer(double& seconds) :
+			_seconds(seconds), _start(std::chrono::steady_clock::now()) {
+	}
+	~PhaseTimer() {
+		_seconds += std::chrono::duration<double>(
+				std::chrono::steady_clock::now() - _start).count();
+	}
+};
+
+template<class T>
+double TopicModel<T>::logLikelihood(void) {
+	PhaseTimer timer(_phaseTimes.loglik);
+	if (!_shards.empty())
+		return _shardedLogLikelihood();
+	if (_stream != NULL)
+		return _streamPass(NULL);
+
+	/*
+	 * Per-unit partials summed in unit order, so that the result does not
+	 * depend on the number of threads or the schedule.
+	 */
+	_buildUnits();
+	size_t nUnits = _unitSegment.size();
+	std::vector<double> unitLoglik(nUnits, 0.0);
+	_forEachUnit([&](size_t u) {
+		unitLoglik[u] = _logLikelihoodRecords(_unitSegment[u],
+				_unitBegin[u], _unitEnd[u]);
+	});
+	return unitLoglik.empty() ? 0.0 : kahanSum(&unitLoglik[0], nUnits);
+}
+
+/* log-likelihood of records [begin, end) of segment s */
+template<class T>
+double TopicModel<T>::_logLikelihoodRecords(size_t s, size_t begin,
+		size_t end) {
+	double res = 0.0;
+	size_t n, k;
+	T *seg = _segments[s];
+	const std::vector<size_t>& act = seg->active;
+	size_t nActive = act.empty() ? _K : act.size();
+	for (n = begin; n < end; n++) {
+		double tmp = 0.0;
+		for (size_t i = 0; i < nActive; i++) {
+			k = act.empty() ? i : act[i];
+			tmp += seg->theta[k] * _pdf(s, n, k);
+		}
+#ifdef DEBUG
+		switch (fpclassify(tmp)) {
+			case FP_INFINITE:
+			case FP_NAN:
+			case FP_SUBNORMAL:
+			case FP_ZERO:
+			fprintf(stderr, "tmp = %e\n", tmp);
+			for (k = 0; k < almighty->K; k++) {
+				fprintf(stderr, "theta[%u] = %e, po(x) = %e\n",
+						k, seg->theta[k], pdf(almighty, s, k, seg->data[n]));
+			}
+			break;
+			default: // FP_NORMAL
+			break;
+		}
+#endif
+		double r;
+		if (tmp == 0.0) {
+			tmp = DBL_MIN; /* avoiding zero... */
+		}
+		if (!std::isfinite(r = gsl_sf_log(tmp))) /* 0 if the record is certain */
+			failErrno("gsl_sf_log");
+		res += r;
+	}
+	return res;
+}
+
+template<class T>
+void TopicModel<T>::AIC(void) {
+	double params = _numberOfModelParameters();
+	double likelihood = logLikelihood();
+
+	fprintf(stderr, "AIC = %f\n", -2 * likelihood + 2 * params);
+	fprintf(stderr, "1st term (likelihood) = %f\n", -2 * likelihood);
+	fprintf(stderr, "2nd term (parameters) = %f\n", 2 * params);
+}
+
+template<class T>
+void TopicModel<T>::EMAlgorithm(void) {
+	if (!_shards.empty()) {
+		PhaseTimer timer(_phaseTimes.estep);
+		_shardedEMAlgorithm();
+		return;
+	}
+	if (_stream != NULL) {
+		streamEMAlgorithm();
+		return;
+	}
+	_sparseStep();
+	if (_lazyTol > 0.0 || !_storeGamma) {
+		std::valarray<double> stats(0.0, _numberOfSufficientStatistics());
+		{
+			PhaseTimer timer(_phaseTimes.estep);
+			if (_lazyTol > 0.0)
+				_lazyLocalEM(&stats[0]);
+			else
+				_fusedLocalEM(&stats[0]);
+		}
+		PhaseTimer timer(_phaseTimes.mstep);
+		_updateDistParams(&stats[0]);
+		return;
+	}
+	{
+		PhaseTimer timer(_phaseTimes.estep);
+		_Estep();
+	}
+	PhaseTimer timer(_phaseTimes.mstep);
+	_Mstep();
+}
+
+/*
+ * One EM iteration in out-of-core mode.
+ * E-step and M-step are fused into a single pass over the dump file, and the
+ * returned log-likelihood is that of the parameters *before* the update.
+ */
+template<class T>
+double TopicModel<T>::streamEMAlgorithm(void) {
+	std::valarray<double> stats(0.0, _numberOfSufficientStatistics());
+	_sparseStep();
+	double res;
+	{
+		PhaseTimer timer(_phaseTimes.estep);
+		res = _streamPass(&stats[0]);
+	}
+	PhaseTimer timer(_phaseTimes.mstep);
+	_updateDistParams(&stats[0]);
+	return res;
+}
+
+/*
+ * One iteration of mini-batch (stepwise) EM.
+ *
+ * A random subset of _batchSize segments is processed as in
+ * _streamPass(): theta of these segments is re-estimated, and their
+ * sufficient statistics, scaled up to the number of records of the whole
+ * data set, are blended into running statistics with the decaying step
+ * size (t + 1)^-_stepDecay, from which the distribution parameters are
+ * updated.  The cost of an iteration depends on the batch size only.
+ * Returns the log-likelihood of the batch before the update, scaled like
+ * the statistics; it is a noisy estimate of the full one.
+ */
+template<class T>
+double TopicModel<T>::miniBatchEMAlgorithm(void) {
+	size_t nStats = _numberOfSufficientStatistics();
+	_sparseStep();
+	std::vector<size_t> batch;
+	_sampleSegments(batch);
+	size_t m = batch.size();
+	std::vector<double> segStats(m * nStats, 0.0);
+	std::vector<double> segLoglik(m, 0.0);
+
+	size_t i;
+	ParallelErrors errors;
+#ifdef _OPENMP
+#pragma omp parallel for schedule(dynamic)
+#endif
+	for (i = 0; i < m; i++) {
+		errors.run([&] {
+			size_t s = batch[i];
+			std::vector<ValueT> x;
+			_segmentRecords(s, x);
+			segLoglik[i] = _EMSegment(_segments[s], x.data(), _segmentSize(s),
+					&segStats[i * nStats]);
+		});
+	}
+	errors.rethrow();
+
+	size_t nRecords = 0, nBatchRecords = 0;
+	for (size_t s = 0; s < _segments.size(); s++)
+		nRecords += _segmentSize(s);
+	for (i = 0; i < m; i++)
+		nBatchRecords += _segmentSize(batch[i]);
+	double scale = (double) nRecords / (double) std::max(nBatchRecords,
+			(size_t) 1);
+	double step = (_batchStats.size() == nStats) ?
+			std::pow((double) (_nMiniBatchItr + 1), -_stepDecay) : 1.0;
+	_batchStats.resize(nStats, 0.0);
+	for (size_t j = 0; j < nStats && m > 0; j++) {
+		double delta = 0.0, sum = 0.0;
+		kahanAccumulate(&sum, &delta, &segStats[j], m, nStats);
+		_batchStats[j] = (1.0 - step) * _batchStats[j] + step * scale * sum;
+	}
+	_updateDistParams(_batchStats.data());
+	++_nMiniBatchItr;
+	return kahanSum(segLoglik.data(), m) * scale;
+}
+
+/*
+ * Draw min(_batchSize, S) distinct segments uniformly at random (Floyd's
+ * algorithm), in increasing order.
+ */
+template<class T>
+void TopicModel<T>::_sampleSegments(std::vector<size_t>& batch) {
+	size_t nSegs = _segments.size();
+	size_t m = std::min(_batchSize, nSegs);
+	std::set<size_t> chosen;
+	for (size_t j = nSegs - m; j < nSegs; j++) {
+		std::uniform_int_distribution<size_t> pick(0, j);
+		size_t s = pick(_rng);
+		if (!chosen.insert(s).second)
+			chosen.insert(j);
+	}
+	batch.assign(chosen.begin(), chosen.end());
+}
+
+/*
+ * Stream all segments from the dump once.  Unless stats is NULL, theta of
+ * each segment is re-estimated and the sufficient statistics for the
+ * distribution parameters are added to stats.  Returns the log-likelihood of
+ * the parameters at the beginning of the pass.
+ */
+template<class T>
+double TopicModel<T>::_streamPass(double *stats) {
+	size_t nStats = _numberOfSufficientStatistics();
+	bool update = (stats != NULL);
+	double res = 0.0;
+	/* compensation terms carried across chunks (see kahanAccumulate()) */
+	double resDelta = 0.0;
+	std::vector<double> statsDelta(nStats, 0.0);
+
+	_stream->beginPass();
+	size_t first, last;
+	while (_stream->nextChunk(first, last)) {
+		size_t m = last - first;
+		std::vector<double> segStats(update ? m * nStats : 0, 0.0);
+		std::vector<double> segLoglik(m, 0.0);
+		size_t i;
+		ParallelErrors errors;
+#ifdef _OPENMP
+#pragma omp parallel for schedule(dynamic)
+#endif
+		for (i = 0; i < m; i++) {
+			errors.run([&] {
+				size_t s = first + i;
+				std::vector<ValueT> x;
+				_segmentRecords(s, x);
+				segLoglik[i] = _EMSegment(_segments[s], x.data(),
+						_segmentSize(s), update ? &segStats[i * nStats] : NULL);
+			});
+		}
+		errors.rethrow();
+		kahanAccumulate(&res, &resDelta, &segLoglik[0], m, 1);
+		for (size_t j = 0; update && j < nStats; j++) {
+			kahanAccumulate(&stats[j], &statsDelta[j], &segStats[j], m, nStats);
+		}
+	}
+	_stream->endPass();
+	return res;
+}
+
+/*
+ * E-step for the records x[0..nData) of one segment, followed by the
+ * segment-local part of the M-step when stats is not NULL: theta is updated
+ * and the sufficient statistics are added to stats.
+ * Returns the log-likelihood of the records under the current parameters.
+ */
+template<class T>
+double TopicModel<T>::_EMSegment(T *seg, const ValueT *x, size_t nData,
+		double *stats) {
+	std::valarray<double> gamma_total(0.0, _K);
+	double res = _EMRecords(seg, x, nData, &gamma_total[0], stats);
+	if (stats != NULL) {
+		seg->theta = gamma_total / (double) nData;
+		_pruneTheta(seg);
+	}
+	return res;
+}
+
+/*
+ * The E-step part of _EMSegment(): the log-likelihood of the records
+ * x[0..nData) of seg, and, when stats is not NULL, their responsibilities
+ * added to gammaTotal and their sufficient statistics to stats.
+ */
+template<class T>
+double TopicModel<T>::_EMRecords(T *seg, const ValueT *x, size_t nData,
+		double *gammaTotal, double *stats) {
+	size_t dim = _bytesPerRecord() / sizeof(ValueT);
+	std::valarray<double> g(0.0, _K);
+	const std::vector<size_t>& act = seg->active;
+	size_t nActive = act.empty() ? _K : act.size();
+	double res = 0.0;
+	for (size_t n = 0; n < nData; n++) {
+		const ValueT *xn = x + n * dim;
+		for (size_t i = 0; i < nActive; i++) {
+			size_t k = act.empty() ? i : act[i];
+			g[k] = seg->theta[k] * _pdfOfRecord(xn, k);
+		}
+		double tmp = g.sum();
+
+		/* log-likelihood */
+		double r, l = tmp;
+		if (l == 0.0) {
+			l = DBL_MIN; /* avoiding zero... */
+		}
+		if (!std::isfinite(r = gsl_sf_log(l)))
+			failErrno("gsl_sf_log");
+		res += r;
+
+		if (stats == NULL)
+			continue;
+
+		/* responsibilities */
+		if (std::fpclassify(tmp) == FP_ZERO) {
+			/* assume uniform over the active components */
+			for (size_t i = 0; i < nActive; i++) {
+				g[act.empty() ? i : act[i]] = 1.0 / (double) nActive;
+			}
+		} else {
+			g /= tmp;
+		}
+		for (size_t k = 0; k < _K; k++)
+			gammaTotal[k] += g[k];
+		_accumulateSufficientStatistics(xn, &g[0], stats);
+	}
+	return res;
+}
+
+/*
+ * Work units of the in-memory E-step, M-step and log-likelihood: a segment
+ * is one unit unless it has more than maxUnitRecords records, in which case
+ * its records are split into ranges of that size, so that a few huge
+ * segments do not leave the other threads idle at the end of a loop.  The
+ * size is fixed (not derived from the number of threads) to keep the
+ * reductions, which go in unit order, independent of the thread count.
+ */
+static const size_t maxUnitRecords = 1 << 16;
+
+template<class T>
+void TopicModel<T>::_buildUnits(void) {
+	if (_firstUnit.size() == _segments.size() + 1)
+		return;
+	_unitSegment.clear();
+	_ownerFirst.clear();
+	_unitBegin.clear();
+	_unitEnd.clear();
+	_firstUnit.assign(1, 0);
+	for (size_t s = 0; s < _segments.size(); s++) {
+		size_t n = _segments[s]->data.size();
+		size_t begin = 0;
+		do {
+			size_t end = (n - begin > maxUnitRecords) ? begin + maxUnitRecords : n;
+			_unitSegment.push_back(s);
+			_unitBegin.push_back(begin);
+			_unitEnd.push_back(end);
+			begin = end;
+		} while (begin < n);
+		_firstUnit.push_back(_unitSegment.size());
+	}
+}
+
+/* number of work units of a segment of nData records */
+template<class T>
+size_t TopicModel<T>::_unitCount(size_t nData) {
+	return (nData == 0) ? 1 : (nData + maxUnitRecords - 1) / maxUnitRecords;
+}
+
+/*
+ * _EMSegment() on the records x[0..nData) of seg, split into work units as
+ * by _buildUnits(): the sufficient statistics of its i-th unit are added to
+ * unitStats + i * (# of statistics), and theta is updated from the units
+ * in order, so that the result equals that of _Estep() and
+ * _sufficientStatistics() bit for bit.
+ */
+template<class T>
+void TopicModel<T>::_EMUnits(T *seg, const ValueT *x, size_t nData,
+		double *unitStats) {
+	size_t dim = _bytesPerRecord() / sizeof(ValueT);
+	size_t nStats = _numberOfSufficientStatistics();
+	size_t nUnits = _unitCount(nData);
+	std::vector<double> gammaTotals(nUnits * _K, 0.0);
+	for (size_t i = 0; i < nUnits; i++) {
+		size_t begin = i * maxUnitRecords;
+		size_t end = std::min(nData, begin + maxUnitRecords);
+		_EMRecords(seg, x + begin * dim, end - begin, &gammaTotals[i * _K],
+				unitStats + i * nStats);
+	}
+	_updateTheta(seg, &gammaTotals[0], nUnits);
+}
+
+template<class T>
+void TopicModel<T>::_Estep(void) {
+	/* compute gamma[s][n][k] */
+	_buildUnits();
+	_forEachUnit([&](size_t u) {
+		_EstepRecords(_unitSegment[u], _unitBegin[u], _unitEnd[u]);
+	});
+}
+
+template<class T>
+template<class F>
+void TopicModel<T>::_forEachUnit(F f) {
+	_forEachUnit(f, 0, _unitSegment.size());
+}
+
+/*
+ * Call f(u) for every work unit u in [first, last) in parallel.  Units go
+ * to whichever thread is free, or, with _affinity, thread t always takes
+ * the units from _ownerFirst[t] to _ownerFirst[t + 1].
+ */
+template<class T>
+template<class F>
+void TopicModel<T>::_forEachUnit(F f, size_t first, size_t last) {
+	size_t u;
+	ParallelErrors errors;
+	if (!_affinity) {
+#ifdef _OPENMP
+#pragma omp parallel for schedule(dynamic)
+#endif
+		for (u = first; u < last; u++) {
+			errors.run([&] {
+				f(u);
+			});
+		}
+		errors.rethrow();
+		return;
+	}
+	_buildOwners();
+	size_t nOwners = _ownerFirst.size() - 1;
+#ifdef _OPENMP
+#pragma omp parallel num_threads(nOwners)
+#endif
+	{
+		size_t t = 0, step = 1;
+#ifdef _OPENMP
+		t = omp_get_thread_num();
+		step = omp_get_num_threads();
+#endif
+		for (; t < nOwners; t += step) {
+			size_t end = std::min(_ownerFirst[t + 1], last);
+			for (size_t v = std::max(_ownerFirst[t], first); v < end; v++) {
+				errors.run([&] {
+					f(v);
+				});
+			}
+		}
+	}
+	errors.rethrow();
+}
+
+/* one contiguous range of units per thread, balanced by records */
+template<class T>
+void TopicModel<T>::_buildOwners(void) {
+	size_t nThreads = 1;
+#ifdef _OPENMP
+	nThreads = omp_get_max_threads();
+#endif
+	size_t nUnits = _unitSegment.size();
+	if (_ownerFirst.size() == nThreads + 1 && _ownerFirst.back() == nUnits)
+		return;
+	size_t total = 0, done = 0;
+	for (size_t u = 0; u < nUnits; u++)
+		total += _unitEnd[u] - _unitBegin[u];
+	_ownerFirst.assign(1, 0);
+	for (size_t u = 0; u < nUnits; u++) {
+		done += _unitEnd[u] - _unitBegin[u];
+		/* thread t stops once t + 1 shares of the records are covered */
+		while (_ownerFirst.size() < nThreads
+				&& done * nThreads >= total * _ownerFirst.size())
+			_ownerFirst.push_back(u + 1);
+	}
+	while (_ownerFirst.size() < nThreads + 1)
+		_ownerFirst.push_back(nUnits);
+}
+
+/*
+ * First touch: the records and theta of each segment are copied by the
+ * thread that owns its first unit, and the old copies freed.
+ */
+template<class T>
+void TopicModel<T>::_placeSegments(void) {
+	_buildUnits();
+	_forEachUnit([&](size_t u) {
+		if (_unitBegin[u] != 0)
+			return;
+		T *seg = _segments[_unitSegment[u]];
+		std::vector<ObservedValue<std::valarray<ValueT>>> data(seg->data);
+		seg->data.swap(data);
+		std::valarray<double> theta(seg->theta);
+		seg->theta.swap(theta);
+	});
+}
+
+template<class T>
+void TopicModel<T>::_EstepSegment(size_t s) {
+	_EstepRecords(s, 0, _segments[s]->data.size());
+}
+
+/* responsibilities of records [begin, end) of segment s */
+template<class T>
+void TopicModel<T>::_EstepRecords(size_t s, size_t begin, size_t end) {
+	size_t n, k;
+	T *seg = _segments[s];
+	const std::vector<size_t>& act = seg->active;
+	size_t nActive = act.empty() ? _K : act.size();
+	for (n = begin; n < end; n++) {
+		std::valarray<double> g(0.0, _K);
+		for (size_t i = 0; i < nActive; i++) {
+			k = act.empty() ? i : act[i];
+			g[k] = _pdf(s, n, k);
+		}
+		seg->data[n].gamma = seg->theta * g;
+		double gamma_denom = seg->data[n].gamma.sum();
 #ifdef DEBUG
-			if (fpclassify(gamma_denom) == FP_ZERO ||
-					fpclassify(gamma_denom) == FP_SUBNORMAL) {
-				fprintf(stderr, "gamma_denom=%e\n", gamma_denom);
-				fprintf(stderr, "x[s][n] = %.20e\n", ((double *) seg->data[n]->x)[0]);
-				for (k = 0; k < almighty->K; k++) {
-					fprintf(stderr, "k=%u, theta=%e, g=%e, eta=%e\n",
-							k, seg->theta[k], pdf(almighty, s, k, seg->data[n]), eta[k]);
-					fprintf(stderr, "a=%e, b=%e, gamma(x|k)=%e\n",
-							almighty->poissons[k]->lambda[0],
-							almighty->poissons[k]->lambda[1],
-							gsl_ran_gamma_pdf(((double *) seg->data[n]->x)[0],
-									almighty->poissons[k]->lambda[0],
-									almighty->poissons[k]->lambda[1]));
-				}
+		if (fpclassify(gamma_denom) == FP_ZERO ||
+				fpclassify(gamma_denom) == FP_SUBNORMAL) {
+			fprintf(stderr, "gamma_denom=%e\n", gamma_denom);
+			fprintf(stderr, "x[s][n] = %.20e\n", ((double *) seg->data[n]->x)[0]);
+			for (k = 0; k < almighty->K; k++) {
+				fprintf(stderr, "k=%u, theta=%e, g=%e, eta=%e\n",
+						k, seg->theta[k], pdf(almighty, s, k, seg->data[n]), eta[k]);
+				fprintf(stderr, "a=%e, b=%e, gamma(x|k)=%e\n",
+						almighty->poissons[k]->lambda[0],
+						almighty->poissons[k]->lambda[1],
+						gsl_ran_gamma_pdf(((double *) seg->data[n]->x)[0],
+								almighty->poissons[k]->lambda[0],
+								almighty->poissons[k]->lambda[1]));
 			}
+		}
 #endif
-			/* compute gamma[s][n][k] */
-			if (std::fpclassify(gamma_denom) == FP_ZERO) {
-				/* assume uniform */
+		/* compute gamma[s][n][k] */
+		if (std::fpclassify(gamma_denom) == FP_ZERO) {
+			/* assume uniform over the active components */
+			if (act.empty()) {
 				seg->data[n].gamma = 1.0 / (double) _K;
 			} else {
-				seg->data[n].gamma /= gamma_denom;
+				seg->data[n].gamma = 0.0;
+				for (size_t i = 0; i < nActive; i++) {
+					seg->data[n].gamma[act[i]] = 1.0 / (double) nActive;
+				}
+			}
+		} else {
+			seg->data[n].gamma /= gamma_denom;
+		}
+	} // end for [n]
+}
+
+/*
+ * Local part of the M-step: update theta of each segment from the
+ * responsibilities and add the sufficient statistics for the distribution
+ * parameters to stats.  Segments are reduced in a fixed order.
+ */
+template<class T>
+void TopicModel<T>::_sufficientStatistics(double *stats) {
+	size_t nStats = _numberOfSufficientStatistics();
+
+	/* per-unit sufficient statistics and sums of responsibilities */
+	_buildUnits();
+	size_t nUnits = _unitSegment.size();
+	std::vector<double> unitStats(nUnits * nStats, 0.0);
+	std::vector<double> unitGamma(nUnits * _K, 0.0);
+
+	_forEachUnit([&](size_t u) {
+		_MstepRecords(_unitSegment[u], _unitBegin[u], _unitEnd[u],
+				&unitGamma[u * _K], &unitStats[u * nStats]);
+	});
+
+	/* theta of each segment from its units, by the owner of the first */
+	_forEachUnit([&](size_t u) {
+		if (_unitBegin[u] != 0)
+			return;
+		size_t s = _unitSegment[u];
+		_updateTheta(_segments[s], &unitGamma[u * _K], _firstUnit[s + 1] - u);
+	});
+
+	for (size_t j = 0; j < nStats && nUnits > 0; ++j) {
+		double delta = 0.0;
+		kahanAccumulate(&stats[j], &delta, &unitStats[j], nUnits, nStats);
+	}
+}
+
+/* update theta of segment s and add its sufficient statistics to st */
+template<class T>
+void TopicModel<T>::_MstepSegment(size_t s, double *st) {
+	std::valarray<double> gamma_total(0.0, _K);
+	_MstepRecords(s, 0, _segments[s]->data.size(), &gamma_total[0], st);
+	_updateTheta(_segments[s], &gamma_total[0], 1);
+}
+
+/*
+ * Add the responsibilities of records [begin, end) of segment s to
+ * gammaTotal and their sufficient statistics to st.
+ */
+template<class T>
+void TopicModel<T>::_MstepRecords(size_t s, size_t begin, size_t end,
+		double *gammaTotal, double *st) {
+	T *seg = _segments[s];
+	for (size_t n = begin; n < end; ++n) {
+		for (size_t k = 0; k < _K; ++k)
+			gammaTotal[k] += seg->data[n].gamma[k];
+		_accumulateSufficientStatistics(&seg->data[n].value[0],
+				&seg->data[n].gamma[0], st);
+	}
+}
+
+/* theta of seg from the sums of responsibilities of its nUnits units */
+template<class T>
+void TopicModel<T>::_updateTheta(T *seg, const double *gammaTotals,
+		size_t nUnits) {
+	std::valarray<double> gamma_total(gammaTotals, _K);
+	for (size_t i = 1; i < nUnits; ++i) {
+		gamma_total += std::valarray<double>(gammaTotals + i * _K, _K);
+	}
+	seg->theta = gamma_total / (double) seg->data.size();
+	_pruneTheta(seg);
+}
+
+/*
+ * Sparse mixing coefficients: components whose theta falls below
+ * _sparseEps are set to zero and removed from the active list of the
+ * segment, so that the E-step no longer evaluates their densities.  Since a
+ * zero theta stays zero under EM, _sparseStep() periodically gives them a
+ * theta of _sparseEps again and lets the next iteration decide.
+ */
+template<class T>
+void TopicModel<T>::_pruneTheta(T *seg) {
+	if (_sparseEps <= 0.0)
+		return;
+	size_t kmax = 0;
+	for (size_t k = 1; k < _K; k++) {
+		if (seg->theta[k] > seg->theta[kmax])
+			kmax = k;
+	}
+	seg->active.clear();
+	for (size_t k = 0; k < _K; k++) {
+		if (seg->theta[k] < _sparseEps && k != kmax) {
+			seg->theta[k] = 0.0;
+		} else {
+			seg->active.push_back(k);
+		}
+	}
+	if (seg->active.size() == _K) {
+		seg->active.clear();
+	} else {
+		seg->theta /= seg->theta.sum();
+	}
+}
+
+/* count EM iterations and re-activate pruned components when due */
+template<class T>
+void TopicModel<T>::_sparseStep(void) {
+	if (_sparseEps <= 0.0)
+		return;
+	if (_reactivateEvery > 0 && _nSparseItr > 0
+			&& _nSparseItr % _reactivateEvery == 0) {
+		size_t s;
+#ifdef _OPENMP
+#pragma omp parallel for
+#endif
+		for (s = 0; s < _segments.size(); s++) {
+			T *seg = _segments[s];
+			if (seg->active.empty())
+				continue;
+			for (size_t k = 0; k < _K; k++) {
+				if (seg->theta[k] == 0.0)
+					seg->theta[k] = _sparseEps;
+			}
+			seg->theta /= seg->theta.sum();
+			seg->active.clear();
+		}
+		_segStats.clear(); /* lazy EM has to recompute everything */
+	}
+	++_nSparseItr;
+}
+
+/*
+ * Lazy EM (in memory).
+ *
+ * The cached statistics of a segment remember the distribution parameters
+ * they were computed with.  A segment is frozen when its theta moved by less
+ * than the tolerance in its last update and, since its statistics were
+ * computed, the log pdf of no value within the range of the segment has
+ * changed by the tolerance or more under any component (see
+ * _logPdfChange()); each of its responsibilities is then off by a factor of
+ * less than exp(2 * tolerance), however many iterations it stays frozen.
+ * Frozen segments are skipped in the E-step and the M-step, and their cached
+ * sufficient statistics are reused.  Every _lazyFullPass iterations all
+ * segments are recomputed.
+ */
+template<class T>
+void TopicModel<T>::_lazyLocalEM(double *stats) {
+	size_t nSegs = _segments.size();
+	size_t nStats = _numberOfSufficientStatistics();
+	size_t nParams = _numberOfDistParams();
+	size_t dim = _bytesPerRecord() / sizeof(ValueT);
+
+	bool full = (_segStats.size() != nSegs * nStats
+			|| _segParamsAt.size() != nSegs
+			|| (_lazyFullPass > 0 && _nLazyItr % _lazyFullPass == 0));
+	if (full) {
+		_segStats.assign(nSegs * nStats, 0.0);
+		_thetaChange.assign(nSegs, DBL_MAX);
+		_segParamsAt.assign(nSegs, 0);
+		_lazyParams.clear();
+	}
+	size_t at = _lazyParams.size() / nParams;
+	_lazyParams.resize((at + 1) * nParams);
+	_getDistParams(&_lazyParams[at * nParams]);
+	const double *params = &_lazyParams[at * nParams];
+	bool measure = (_segRange.size() != nSegs * 2 * dim);
+	if (measure)
+		_segRange.resize(nSegs * 2 * dim);
+
+	/* whole segments, each by the thread of its first unit */
+	_buildUnits();
+	_forEachUnit([&](size_t u) {
+		size_t s = _unitSegment[u];
+		if (_unitBegin[u] != 0)
+			return;
+		T *seg = _segments[s];
+		double *lo = &_segRange[s * 2 * dim], *hi = lo + dim;
+		if (measure) {
+			std::fill(lo, lo + dim, DBL_MAX);
+			std::fill(hi, hi + dim, -DBL_MAX);
+			for (size_t n = 0; n < seg->data.size(); n++) {
+				for (size_t d = 0; d < dim; d++) {
+					lo[d] = std::min(lo[d], (double) seg->data[n].value[d]);
+					hi[d] = std::max(hi[d], (double) seg->data[n].value[d]);
+				}
+			}
+		}
+		if (!full && _thetaChange[s] < _lazyTol
+				&& _logPdfChange(&_lazyParams[_segParamsAt[s] * nParams],
+						params, lo, hi) < _lazyTol)
+			return;
+		std::valarray<double> prev = seg->theta;
+		double *st = &_segStats[s * nStats];
+		std::fill(st, st + nStats, 0.0);
+		_localEMSegment(s, st);
+		_thetaChange[s] = std::abs(seg->theta - prev).max();
+		_segParamsAt[s] = at;
+	});
+
+	for (size_t j = 0; j < nStats && nSegs > 0; ++j) {
+		double delta = 0.0;
+		kahanAccumulate(&stats[j], &delta, &_segStats[j], nSegs, nStats);
+	}
+	++_nLazyItr;
+}
+
+/* E-step and local M-step of segment s in memory, adding to st */
+template<class T>
+void TopicModel<T>::_localEMSegment(size_t s, double *st) {
+	if (_storeGamma) {
+		_EstepSegment(s);
+		_MstepSegment(s, st);
+		return;
+	}
+	std::vector<ValueT> x;
+	_segmentRecords(s, x);
+	_EMSegment(_segments[s], x.data(), _segmentSize(s), st);
+}
+
+/*
+ * E-step and local M-step of all segments without stored responsibilities.
+ * Segments go in chunks, so that the per-unit statistics take bounded
+ * scratch space, and the units are reduced in order as in
+ * _sufficientStatistics(), which this equals bit for bit.  With _affinity,
+ * all segments form one chunk, since a chunk would otherwise fall to the
+ * few threads owning its segments.
+ */
+static const size_t fusedChunkSegments = 1 << 12;
+
+template<class T>
+void TopicModel<T>::_fusedLocalEM(double *stats) {
+	size_t nSegs = _segments.size();
+	size_t nStats = _numberOfSufficientStatistics();
+	size_t chunk = _affinity ? std::max(nSegs, (size_t) 1) : fusedChunkSegments;
+	std::vector<double> statsDelta(nStats, 0.0);
+	std::vector<double> unitStats;
+	_buildUnits();
+	for (size_t first = 0; first < nSegs; first += chunk) {
+		size_t m = std::min(nSegs - first, chunk);
+		size_t u0 = _firstUnit[first], nUnits = _firstUnit[first + m] - u0;
+		unitStats.assign(nUnits * nStats, 0.0);
+		/* whole segments, each by the thread of its first unit */
+		_forEachUnit([&](size_t u) {
+			if (_unitBegin[u] == 0) {
+				size_t s = _unitSegment[u];
+				std::vector<ValueT> x;
+				_segmentRecords(s, x);
+				_EMUnits(_segments[s], x.data(), _segmentSize(s),
+						&unitStats[(u - u0) * nStats]);
+			}
+		}, u0, u0 + nUnits);
+		for (size_t j = 0; j < nStats; j++) {
+			kahanAccumulate(&stats[j], &statsDelta[j], &unitStats[j], nUnits,
+					nStats);
+		}
+	}
+}
+
+/*
+ * Memory accounting.
+ *
+ * Records and responsibilities are small heap blocks each, so the sizes
+ * include what the allocator adds to a block (glibc on 64-bit: 8 bytes of
+ * header, rounded up to 16, at least 32).
+ */
+static size_t heapBytes(size_t n) {
+	return (n == 0) ? 0 : std::max((size_t) 32, (n + 8 + 15) & ~(size_t) 15);
+}
+
+/* bytes per segment ID in SegmentIdTable, assuming IDs of 16 characters */
+static const size_t idBytes = 17 + 2 * sizeof(size_t) + sizeof(uint64_t);
+
+/*
+ * Number of segments, records, and records of the largest segment that
+ * loading the dump at path would give under the threshold and time range,
+ * without loading it: from the statistics in the header if any, else from
+ * the segment headers.
+ */
+template<class T>
+void TopicModel<T>::measureDump(const char *path, size_t& nSegments,
+		size_t& nRecords, size_t& maxRecords) {
+	FILE *fp = fopen(path, "rb");
+	if (fp == NULL)
+		failErrno(path);
+	nSegments = nRecords = maxRecords = 0;
+	try {
+		size_t s = _readDumpHeader(fp);
+		if (_dumpStats.valid && !_hasTimeRange()) {
+			for (const auto& p : _dumpStats.sizes) {
+				if (p.first < _nThres)
+					continue;
+				nSegments += p.second;
+				nRecords += p.first * p.second;
+				maxRecords = std::max(maxRecords, p.first);
+			}
+		} else {
+			SegmentIdTable ids;
+			std::vector<std::vector<DumpPiece>> pieces;
+			_scanChunks(fp, s, ids, pieces);
+			for (const auto& ps : pieces) {
+				size_t n = 0, first, last;
+				for (const DumpPiece& p : ps)
+					n += _selectBlocks(p.blocks, first, last);
+				if (n < _nThres)
+					continue;
+				++nSegments;
+				nRecords += n;
+				maxRecords = std::max(maxRecords, n);
+			}
+		}
+	} catch (...) {
+		fclose(fp);
+		throw;
+	}
+	if (fclose(fp) != 0)
+		failErrno("fclose");
+}
+
+/* the same as measureDump() for the loaded segments */
+template<class T>
+void TopicModel<T>::measureData(size_t& nSegments, size_t& nRecords,
+		size_t& maxRecords) {
+	nSegments = _segments.size();
+	nRecords = maxRecords = 0;
+	for (size_t s = 0; s < nSegments; s++) {
+		nRecords += _segmentSize(s);
+		maxRecords = std::max(maxRecords, _segmentSize(s));
+	}
+}
+
+/*
+ * Estimated peak memory of EM on nSegments segments with nRecords records
+ * in total and at most maxRecords per segment, with the current settings
+ * (lazy EM, sparse theta) and bufferBytes of I/O buffers for MEMORY_STREAM.
+ */
+template<class T>
+MemoryUsage TopicModel<T>::estimateMemory(MemoryStrategy strategy,
+		size_t nSegments, size_t nRecords, size_t maxRecords,
+		size_t bufferBytes) {
+	size_t dim = _bytesPerRecord() / sizeof(ValueT);
+	size_t nStats = _numberOfSufficientStatistics();
+	size_t nThreads = 1;
+#ifdef _OPENMP
+	nThreads = omp_get_max_threads();
+#endif
+	/* a copy of the records of the segment at hand, per thread */
+	size_t segmentCopies = nThreads * maxRecords * dim * sizeof(ValueT);
+
+	MemoryUsage m;
+	m.values = m.gamma = m.scratch = 0;
+	m.segments = nSegments * (sizeof(T) + heapBytes(_K * sizeof(double))
+			+ sizeof(T*) + idBytes);
+	if (_sparseEps > 0.0)
+		m.segments += nSegments * heapBytes(_K * sizeof(size_t));
+	if (_lazyTol > 0.0)
+		m.segments += nSegments * ((nStats + 1 + 2 * dim) * sizeof(double)
+				+ sizeof(size_t));
+
+	if (strategy == MEMORY_STREAM) {
+		m.segments += nSegments * (sizeof(std::vector<RecordBlock>)
+				+ heapBytes(sizeof(RecordBlock)) + 3 * sizeof(size_t));
+		size_t recordBytes = std::max((size_t) 1,
+				nRecords * dim * sizeof(ValueT));
+		size_t chunkSegs = std::max((size_t) 1, std::min(nSegments,
+				bufferBytes / 2 * nSegments / recordBytes));
+		m.scratch = bufferBytes + segmentCopies
+				+ chunkSegs * (nStats + 1) * sizeof(double);
+		return m;
+	}
+
+	m.values = nRecords * (sizeof(ObservedValue<std::valarray<ValueT>>)
+			+ heapBytes(dim * sizeof(ValueT)));
+	if (strategy == MEMORY_GAMMA) {
+		/* work units of _Estep() and _sufficientStatistics() */
+		size_t nUnits = nSegments + nRecords / maxUnitRecords;
+		m.gamma = nRecords * heapBytes(_K * sizeof(double));
+		m.scratch = nUnits * ((nStats + _K + 1) * sizeof(double)
+				+ 3 * sizeof(size_t)) + nSegments * sizeof(size_t);
+	} else {
+		/* work units, and the statistics of those of a chunk */
+		size_t nUnits = nSegments + nRecords / maxUnitRecords;
+		size_t chunkUnits = _affinity ? nUnits : std::min(nUnits,
+				fusedChunkSegments + nRecords / maxUnitRecords);
+		m.scratch = chunkUnits * nStats * sizeof(double)
+				+ nUnits * 3 * sizeof(size_t) + nSegments * sizeof(size_t)
+				+ segmentCopies;
+	}
+	return m;
+}
+
+/*
+ * Memory held by the loaded data and the caches, measured on the containers
+ * themselves; scratch is estimated as in estimateMemory().
+ */
+template<class T>
+MemoryUsage TopicModel<T>::memoryUsage(void) {
+	MemoryUsage m;
+	m.values = m.gamma = 0;
+	m.segments = _segments.capacity() * sizeof(T*) + _ids.bytes()
+			+ (_segStats.capacity() + _thetaChange.capacity()
+					+ _segRange.capacity() + _lazyParams.capacity())
+					* sizeof(double)
+			+ _segParamsAt.capacity() * sizeof(size_t);
+	for (T *seg : _segments) {
+		m.segments += sizeof(T) + heapBytes(seg->theta.size() * sizeof(double))
+				+ heapBytes(seg->active.capacity() * sizeof(size_t))
+				+ heapBytes(seg->time.capacity() * sizeof(int64_t));
+		m.values += seg->data.capacity() * sizeof(seg->data[0]);
+		for (const auto& ov : seg->data) {
+			m.values += heapBytes(ov.value.size() * sizeof(ValueT));
+			m.gamma += heapBytes(ov.gamma.size() * sizeof(double));
+		}
+	}
+	for (const auto& blocks : _streamBlocks) {
+		m.segments += sizeof(blocks)
+				+ heapBytes(blocks.capacity() * sizeof(RecordBlock));
+	}
+
+	size_t nSegs, nRecords, maxRecords;
+	measureData(nSegs, nRecords, maxRecords);
+	MemoryStrategy strategy = (_stream != NULL) ? MEMORY_STREAM
+			: (_storeGamma ? MEMORY_GAMMA : MEMORY_FUSED);
+	m.scratch = estimateMemory(strategy, nSegs, nRecords, maxRecords,
+			0).scratch;
+	if (_stream != NULL)
+		m.scratch += _stream->memoryBytes();
+	return m;
+}
+
+/*
+ * Sharded EM.
+ *
+ * Each worker process holds a contiguous part of the segments (see
+ * setShard()) and keeps their theta.  In every iteration the coordinator
+ * broadcasts the distribution parameters, and the workers return only
+ * their sufficient statistics and log-likelihood, which the coordinator
+ * adds up in shard order.
+ */
+enum ShardCommand {
+	SHARD_EM = 1, SHARD_LOGLIK, SHARD_THETA, SHARD_QUIT
+};
+
+/* worker: answer the coordinator's requests until told to quit */
+template<class T>
+void TopicModel<T>::serveShard(Channel& ch) {
+	size_t nParams = _numberOfDistParams();
+	size_t nStats = _numberOfSufficientStatistics();
+	std::valarray<double> params(nParams), stats(nStats);
+
+	/* introduce ourselves and the segments we hold */
+	ch.sendSize(_shardIndex);
+	ch.sendSize(nParams);
+	ch.sendSize(nStats);
+	ch.sendSize(_segments.size());
+	for (size_t s = 0; s < _segments.size(); s++) {
+		size_t id = _segments[s]->getId();
+		ch.sendSize(_ids.length(id));
+		ch.send(_ids.str(id), _ids.length(id));
+		ch.sendSize(_segmentSize(s));
+	}
+
+	for (;;) {
+		size_t cmd = ch.receiveSize();
+		switch (cmd) {
+		case SHARD_EM:
+			ch.receive(&params[0], sizeof(double) * nParams);
+			_setDistParams(&params[0]);
+			stats = 0.0;
+			_sparseStep();
+			if (_stream != NULL) {
+				_streamPass(&stats[0]);
+			} else if (_lazyTol > 0.0) {
+				_lazyLocalEM(&stats[0]);
+			} else if (!_storeGamma) {
+				_fusedLocalEM(&stats[0]);
+			} else {
+				_Estep();
+				_sufficientStatistics(&stats[0]);
+			}
+			ch.send(&stats[0], sizeof(double) * nStats);
+			break;
+		case SHARD_LOGLIK: {
+			ch.receive(&params[0], sizeof(double) * nParams);
+			_setDistParams(&params[0]);
+			double l = logLikelihood();
+			ch.send(&l, sizeof(double));
+			break;
+		}
+		case SHARD_THETA:
+			for (size_t s = 0; s < _segments.size(); s++) {
+				ch.send(&_segments[s]->theta[0], sizeof(double) * _K);
 			}
-		} // end for [n]
-	} // end for [s]
+			break;
+		case SHARD_QUIT:
+			return;
+		default:
+			fail("unknown shard command ", cmd);
+		}
+	}
+}
+
+/*
+ * coordinator: receive the segment lists of the workers.
+ * Afterwards, EMAlgorithm() and logLikelihood() run on the workers.
+ */
+template<class T>
+void TopicModel<T>::attachShards(std::vector<Channel*>& shards) {
+	size_t nShards = shards.size();
+	std::vector<std::vector<T*>> segs(nShards);
+	std::vector<std::vector<size_t>> sizes(nShards);
+	_clearSegments();
+	_ids.clear();
+	_shards.assign(nShards, NULL);
+
+	for (size_t c = 0; c < nShards; c++) {
+		size_t index = shards[c]->receiveSize();
+		if (index >= nShards || _shards[index] != NULL) {
+			fail("bad shard index ", index);
+		}
+		_shards[index] = shards[c];
+		size_t nParams = shards[c]->receiveSize();
+		size_t nStats = shards[c]->receiveSize();
+		if (nParams != _numberOfDistParams()
+				|| nStats != _numberOfSufficientStatistics()) {
+			fail("shard ", index, " has a different model (check -k and -d).");
+		}
+		size_t m = shards[c]->receiveSize();
+		for (size_t i = 0; i < m; i++) {
+			std::string id(shards[c]->receiveSize(), '\0');
+			shards[c]->receive(&id[0], id.length());
+			T *seg = new T(_ids.insert(id.data(), id.length()));
+			_initLatentParams(seg);
+			segs[index].push_back(seg);
+			sizes[index].push_back(shards[c]->receiveSize());
+		}
+	}
+
+	_shardCounts.resize(nShards);
+	for (size_t c = 0; c < nShards; c++) {
+		_shardCounts[c] = segs[c].size();
+		_segments.insert(_segments.end(), segs[c].begin(), segs[c].end());
+		_remoteSizes.insert(_remoteSizes.end(), sizes[c].begin(),
+				sizes[c].end());
+	}
+}
+
+/* coordinator: fetch theta of all segments and let the workers quit */
+template<class T>
+void TopicModel<T>::detachShards(void) {
+	size_t s = 0;
+	for (size_t c = 0; c < _shards.size(); c++) {
+		_shards[c]->sendSize(SHARD_THETA);
+		for (size_t i = 0; i < _shardCounts[c]; i++, s++) {
+			_shards[c]->receive(&_segments[s]->theta[0], sizeof(double) * _K);
+		}
+		_shards[c]->sendSize(SHARD_QUIT);
+	}
+	_shards.clear();
+}
+
+template<class T>
+void TopicModel<T>::_broadcastDistParams(size_t cmd) {
+	std::valarray<double> params(_numberOfDistParams());
+	_getDistParams(&params[0]);
+	for (size_t c = 0; c < _shards.size(); c++) {
+		_shards[c]->sendSize(cmd);
+		_shards[c]->send(&params[0], sizeof(double) * params.size());
+	}
+}
+
+template<class T>
+void TopicModel<T>::_shardedEMAlgorithm(void) {
+	size_t nStats = _numberOfSufficientStatistics();
+	size_t nShards = _shards.size();
+	std::valarray<double> stats(0.0, nStats);
+	std::vector<double> part(nShards * nStats);
+
+	/* per-shard partials summed in shard order */
+	_broadcastDistParams(SHARD_EM);
+	for (size_t c = 0; c < nShards; c++)
+		_shards[c]->receive(&part[c * nStats], sizeof(double) * nStats);
+	for (size_t j = 0; j < nStats && nShards > 0; ++j) {
+		double delta = 0.0;
+		kahanAccumulate(&stats[j], &delta, &part[j], nShards, nStats);
+	}
+	_updateDistParams(&stats[0]);
+}
+
+template<class T>
+double TopicModel<T>::_shardedLogLikelihood(void) {
+	std::vector<double> part(_shards.size());
+	_broadcastDistParams(SHARD_LOGLIK);
+	for (size_t c = 0; c < _shards.size(); c++)
+		_shards[c]->receive(&part[c], sizeof(double));
+	return part.empty() ? 0.0 : kahanSum(&part[0], part.size());
 }
 
 template<class T>
@@ -342,13 +3300,10 @@ double TopicModel<T>::_finitePositiveValue(double x) {
 		break;
 	case FP_INFINITE:
 	case FP_NAN:
-		std::cerr << "updated lambda = " << x << std::endl;
-		std::cerr << "abort." << std::endl;
-		exit(1);
+		fail("updated lambda = ", x, ", abort.");
 		break;
 	default:
-		std::cerr << "Bad fortune. Abort." << std::endl;
-		exit(2);
+		fail("updated lambda = ", x, " is not classifiable, abort.");
 		break;
 	}
 }
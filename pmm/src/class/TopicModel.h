@@ -24,13 +24,81 @@
 #include <list>
 #include <vector>
 #include <valarray>
-#include <unordered_map>
+#include <random>
+#include <cstdint>
+#include <utility>
+#include <atomic>
 
 #include "SegmentObservingVector.h"
+#include "SegmentIdTable.h"
+#include "DumpStream.h"
+#include "Channel.h"
+#include "Checkpoint.h"
+
+/*
+ * Dump files written with flags start with PMM_DUMP_MAGIC and the flags;
+ * others start directly with the dimension (see loadDataDump()).
+ */
+#define PMM_DUMP_MAGIC ((size_t) 0x01706d6d64756d70ULL)
+#define PMM_THETA_MAGIC ((size_t) 0x01706d6d74687461ULL) /* see _writeThetaBinary() */
+enum DumpFlag {
+	DUMP_PACKED = 1, /* records of a segment are bit-packed (bitpack.h) */
+	DUMP_BUCKETED = 2, /* records of a segment are grouped by time bucket */
+	DUMP_CHUNKED = 4, /* appended chunks of segments follow the first one */
+	DUMP_STATS = 8 /* the header holds DumpStats */
+};
+
+/* index entry of the records of a segment (one per bucket if bucketed) */
+struct RecordBlock {
+	int64_t bucket; /* timestamp / bucket width */
+	size_t nData; /* number of records */
+	size_t bytes; /* size of the encoded records */
+};
+
+/* summary of the data set in a dump, computed by csv2dump */
+struct DumpStats {
+	bool valid; /* false: none, or records were appended since */
+	size_t nRecords;
+	std::vector<std::pair<size_t, size_t>> sizes; /* (records, # of segments) */
+	std::vector<double> valueMin, valueMax; /* per dimension */
+};
+
+/* records of a segment in one chunk of a DUMP_CHUNKED dump */
+struct DumpPiece {
+	long offset; /* file offset of the records blocks */
+	std::vector<RecordBlock> blocks;
+};
+
+/* where the records and their responsibilities live during EM */
+enum MemoryStrategy {
+	MEMORY_GAMMA, /* records and responsibilities in memory (fastest) */
+	MEMORY_FUSED, /* records in memory; E- and M-step fused per segment */
+	MEMORY_STREAM /* records read from the dump in every pass (out-of-core) */
+};
+
+/* bytes of an estimation run by purpose, including allocator overhead */
+struct MemoryUsage {
+	size_t values; /* records */
+	size_t gamma; /* responsibilities of the records */
+	size_t segments; /* theta, IDs, indexes and caches of the segments */
+	size_t scratch; /* work areas of an iteration, I/O buffers */
+	size_t total(void) const {
+		return values + gamma + segments + scratch;
+	}
+};
+
+/* seconds spent in the phases of EM */
+struct PhaseTimes {
+	double estep; /* responsibilities (and theta, if fused; all if sharded) */
+	double mstep; /* sufficient statistics and distribution parameters */
+	double loglik; /* log-likelihood */
+};
 
 template<class SegmentT>
 class TopicModel {
 protected:
+	typedef typename SegmentT::value_type ValueT;
+
 	/* protected member variables */
 	const size_t _K; /* # of components */
 	const size_t _D; /* data dimension */
@@ -38,27 +106,164 @@ protected:
 	const bool _doSrand;
 
 	size_t _nThres; /* minimum data size a segment must contain */
+	size_t _dumpFlags; /* DumpFlag of the dump being read or written */
+	std::mt19937 _rng; /* for randomized algorithms other than uniform init */
 	std::vector<SegmentT*> _segments; /* list of segments */
+	SegmentIdTable _ids; /* IDs of the segments */
+	DumpStream *_stream; /* non-NULL in out-of-core mode */
+	size_t _shardIndex, _nShards; /* part of the dump this process loads */
+	size_t _bucketWidth; /* seconds per bucket of DUMP_BUCKETED dumps */
+	int64_t _timeFrom, _timeTo; /* use records in [_timeFrom, _timeTo) */
+	std::vector<std::vector<RecordBlock>> _streamBlocks; /* blocks in _stream */
+	std::vector<SegmentT*> _pending; /* by ID index, filled by addRecords() */
+	std::vector<size_t> _segmentOfId; /* ID index -> segment (findSegment()) */
+	std::vector<Channel*> _shards; /* workers, when coordinating sharded EM */
+	std::vector<size_t> _shardCounts; /* # of segments held by each worker */
+	std::vector<size_t> _remoteSizes; /* sizes of segments held by workers */
+	std::vector<size_t> _unitSegment; /* work unit -> segment */
+	std::vector<size_t> _unitBegin, _unitEnd; /* records of each unit */
+	std::vector<size_t> _firstUnit; /* segment -> first unit, + # of units */
+	std::string _thetaPath; /* write theta there in binary instead of stdout */
+	DumpStats _dumpStats; /* from the header of the loaded dump */
+	bool _storeGamma; /* keep the responsibilities of every record */
+	size_t _readBudget; /* bytes CSV input may need when fused; 0: any */
+	bool _affinity; /* fixed unit-to-thread assignment (see setAffinity()) */
+	std::vector<size_t> _ownerFirst; /* thread t owns units from _ownerFirst[t] */
+	PhaseTimes _phaseTimes;
+
+	/* lazy EM */
+	double _lazyTol; /* 0: disabled */
+	size_t _lazyFullPass; /* recompute all segments every this many iterations */
+	size_t _nLazyItr;
+	std::vector<double> _lazyParams; /* of each iteration since a full pass */
+	std::vector<size_t> _segParamsAt; /* _lazyParams entry of each cache */
+	std::vector<double> _segStats; /* cached sufficient statistics */
+	std::vector<double> _thetaChange; /* change of theta in the last update */
+	std::vector<double> _segRange; /* min and max of each dimension */
+
+	/* sparse mixing coefficients */
+	double _sparseEps; /* prune components with smaller theta; 0: disabled */
+	size_t _reactivateEvery; /* give pruned components a chance this often */
+	size_t _nSparseItr;
+
+	/* mini-batch EM */
+	size_t _batchSize; /* segments per mini-batch */
+	double _stepDecay; /* step size of mini-batch t is (t + 1)^-_stepDecay */
+	size_t _nMiniBatchItr;
+	std::vector<double> _batchStats; /* running sufficient statistics */
 
 	/* protected interfaces */
-	virtual bool _readDataFileLine(
-			std::unordered_map<std::string, SegmentT*>& hashtable, char *buf,
-			bool forceadd) = 0;
+	virtual bool _readDataFileLine(std::vector<SegmentT*>& table,
+			SegmentIdTable& ids, char *buf, bool forceadd) = 0;
 	virtual bool _loadSegmentDataFromDump(FILE *fp) = 0;
 	virtual bool _saveSegmentDataToDump(FILE *fp, SegmentT* seg) = 0;
 	virtual void _dumpTopicParamsAndSegments(void) = 0;
 	virtual void _Mstep(void) = 0;
 	virtual double _numberOfModelParameters(void) = 0;
 	virtual double _pdf(size_t s, size_t n, size_t k) = 0;
+	virtual size_t _bytesPerRecord(void) = 0;
+	virtual size_t _numberOfSufficientStatistics(void) = 0;
+	virtual double _pdfOfRecord(const ValueT *x, size_t k) = 0;
+	virtual void _accumulateSufficientStatistics(const ValueT *x,
+			const double *gamma, double *stats) = 0;
+	virtual void _updateDistParams(const double *stats) = 0;
+	virtual size_t _numberOfDistParams(void) = 0;
+	virtual void _getDistParams(double *params) = 0;
+	virtual void _setDistParams(const double *params) = 0;
+	virtual void _initDistParamsFromCenters(const double *centers) = 0;
+	virtual double _logPdfChange(const double *from, const double *to,
+			const double *lo, const double *hi) = 0;
+	virtual void _encodeRecords(const ValueT *x, size_t nData,
+			std::vector<unsigned char>& out);
+	virtual bool _decodeRecords(const unsigned char *in, size_t bytes,
+			size_t nData, ValueT *x);
 
 	/* protected member functions */
 	void _clearSegments(void);
-	void _hash2list(std::unordered_map<std::string, SegmentT*>& hashtable);
-	SegmentT* _searchSegment(
-			std::unordered_map<std::string, SegmentT*>& hashtable,
-			std::string id, bool forceadd);
+	void _hash2list(std::vector<SegmentT*>& table);
+	SegmentT* _searchSegment(std::vector<SegmentT*>& table,
+			SegmentIdTable& ids, const char *id, size_t len, bool forceadd);
+	size_t _readLines(FILE *fp, std::vector<SegmentT*>& table,
+			SegmentIdTable& ids, bool forceadd, std::atomic<size_t>& nRead);
+	size_t _readBlockLines(char *block, size_t len,
+			std::vector<SegmentT*>& table, SegmentIdTable& ids, bool forceadd);
+	void _mergeTable(std::vector<SegmentT*>& table,
+			std::vector<SegmentT*>& part, SegmentIdTable& partIds);
+	void _checkReadBudget(size_t nSegments, size_t nRecords);
+	size_t _readDumpHeader(FILE *fp);
+	void _writeDumpHeader(FILE *fp, size_t flags, size_t nSegs,
+			const DumpStats& stats);
+	void _readDumpStats(FILE *fp);
+	void _writeDumpStats(FILE *fp, const DumpStats& stats);
+	void _computeDumpStats(DumpStats& stats);
+	void _printSizeStats(const std::vector<std::pair<size_t, size_t>>& sizes);
+	void _scanChunks(FILE *fp, size_t s, SegmentIdTable& ids,
+			std::vector<std::vector<DumpPiece>>& pieces);
+	void _mergePieces(FILE *fp, const std::vector<DumpPiece>& pieces,
+			std::vector<RecordBlock>& blocks, std::vector<ValueT>& x);
+	void _loadChunkedDump(FILE *fp, size_t s);
+	void _rewriteDump(const char *path, bool chunked);
+	SegmentT* _newSegment(const char *id, size_t len, const ValueT *x,
+			size_t nData);
+	void _shardRange(size_t s, size_t& begin, size_t& end);
+	void _skipSegmentInDump(FILE *fp);
+	size_t _recordsBlockBytes(FILE *fp, size_t nData);
+	void _writeRecords(FILE *fp, const ValueT *x, size_t nData);
+	bool _hasTimeRange(void);
+	bool _inTimeRange(int64_t t);
+	int64_t _bucketOf(int64_t t);
+	void _readBlockIndex(FILE *fp, size_t nData, std::vector<RecordBlock>& blocks);
+	size_t _selectBlocks(const std::vector<RecordBlock>& blocks, size_t& first,
+			size_t& last);
+	bool _decodeBlocks(const unsigned char *in,
+			const std::vector<RecordBlock>& blocks, size_t first, size_t last,
+			ValueT *x);
+	void _readBlocks(FILE *fp, const std::vector<RecordBlock>& blocks,
+			size_t first, size_t last, ValueT *x);
+	void _skipBlocks(FILE *fp, const std::vector<RecordBlock>& blocks);
+	void _writeBlocks(FILE *fp, const ValueT *x, const int64_t *time,
+			size_t nData);
+	size_t _segmentSize(size_t s);
+	void _segmentRecords(size_t s, std::vector<ValueT>& x);
+	template<class F> void _forEachSegment(F f);
+	void _quantileCenters(std::vector<double>& centers);
+	void _kmeansCenters(std::vector<double>& centers);
+	void _buildUnits(void);
+	size_t _unitCount(size_t nData);
+	void _buildOwners(void);
+	template<class F> void _forEachUnit(F f);
+	template<class F> void _forEachUnit(F f, size_t first, size_t last);
+	void _placeSegments(void);
 	void _Estep(void);
+	void _EstepSegment(size_t s);
+	void _EstepRecords(size_t s, size_t begin, size_t end);
+	void _sufficientStatistics(double *stats);
+	void _MstepSegment(size_t s, double *st);
+	void _MstepRecords(size_t s, size_t begin, size_t end, double *gammaTotal,
+			double *st);
+	void _updateTheta(SegmentT *seg, const double *gammaTotals, size_t nUnits);
+	void _lazyLocalEM(double *stats);
+	void _localEMSegment(size_t s, double *st);
+	void _fusedLocalEM(double *stats);
+	void _initLatentParams(SegmentT *seg);
+	double _logLikelihoodRecords(size_t s, size_t begin, size_t end);
+	void _pruneTheta(SegmentT *seg);
+	void _sparseStep(void);
+	void _sampleSegments(std::vector<size_t>& batch);
+	double _EMSegment(SegmentT *seg, const ValueT *x, size_t nData,
+			double *stats);
+	double _EMRecords(SegmentT *seg, const ValueT *x, size_t nData,
+			double *gammaTotal, double *stats);
+	void _EMUnits(SegmentT *seg, const ValueT *x, size_t nData,
+			double *unitStats);
+	double _streamPass(double *stats);
+	void _broadcastDistParams(size_t cmd);
+	void _shardedEMAlgorithm(void);
+	double _shardedLogLikelihood(void);
 	double _finitePositiveValue(double x);
+	void _writeSegments(const size_t *order);
+	void _writeThetaBinary(const size_t *order);
+	size_t _idHash(void);
 
 public:
 	/* constructor & destructor */
@@ -68,21 +273,68 @@ public:
 
 	/* getter & setter */
 	void setThres(size_t nThres);
+	void setShard(size_t index, size_t count);
+	void setDumpFlags(size_t flags);
+	size_t getDumpFlags(void);
+	void setLazy(double tol, size_t fullPass);
+	void setSparse(double eps, size_t reactivateEvery);
+	void setBucketWidth(size_t seconds);
+	void setTimeRange(int64_t from, int64_t to);
+	void setThetaOutput(const std::string& path);
+	void setMiniBatch(size_t segments, double decay);
+	void setStoreGamma(bool store);
+	void setReadBudget(size_t bytes);
+	void setAffinity(bool affinity);
+	PhaseTimes getPhaseTimes(void);
 
 	/* public interface */
 	virtual void validateDataset(void) = 0;
 
 	/* public member functions */
 	void readDataFile(FILE *fp, bool forceadd);
+	void readDataFiles(const std::vector<std::string>& patterns);
 	void loadDataDump(FILE *fp);
+	void loadDataDumpWithEM(FILE *fp);
+	void splitDataDump(FILE *fp, int64_t period,
+			const std::vector<TopicModel<SegmentT>*>& models);
+	void openDataStream(const char *path, size_t bufferBytes);
 	void saveDataDump(const char *path);
+	void appendDataDump(const char *path);
+	void compactDataDump(const char *path);
+	void addRecords(const char * const *ids, const ValueT *x, size_t n);
+	void finishRecords(void);
+
+	void measureDump(const char *path, size_t& nSegments, size_t& nRecords,
+			size_t& maxRecords);
+	void measureData(size_t& nSegments, size_t& nRecords, size_t& maxRecords);
+	MemoryUsage estimateMemory(MemoryStrategy strategy, size_t nSegments,
+			size_t nRecords, size_t maxRecords, size_t bufferBytes);
+	MemoryUsage memoryUsage(void);
 
+	void initDistParams(const std::string& method);
 	void printDataStats(void);
 	void dump(void);
 
+	size_t numberOfSegments(void);
+	const char* segmentId(size_t s);
+	size_t findSegment(const char *id, size_t len);
+	void getTheta(size_t s, double *theta);
+	size_t numberOfDistParams(void);
+	void getDistParams(double *params);
+	double scoreRecord(size_t s, const ValueT *x, double *gamma);
+
+	void saveCheckpoint(Checkpoint& c);
+	void restoreCheckpoint(const Checkpoint& c);
+
 	double logLikelihood(void);
 	void AIC(void);
 	void EMAlgorithm(void);
+	double streamEMAlgorithm(void);
+	double miniBatchEMAlgorithm(void);
+
+	void serveShard(Channel& ch);
+	void attachShards(std::vector<Channel*>& shards);
+	void detachShards(void);
 };
 
 template class TopicModel<SegmentObservingVector<int>>;
@@ -20,6 +20,8 @@
 #include <iostream>
 #include <boost/program_options.hpp>
 #include "class/PoissonMixtureModel.h"
+#include "class/GammaMixtureModel.h"
+#include "class/PmmError.h"
 #include "lib/util.h"
 
 using namespace boost::program_options;
@@ -27,12 +29,25 @@ using namespace boost::program_options;
 template<class T>
 class CSV2Dump {
 public:
-	static void csv2dump(size_t d, FILE *fp, std::string outputPath) {
+	static void csv2dump(size_t d, const std::vector<std::string>& inputs,
+			std::string outputPath, size_t flags, size_t bucketWidth,
+			bool append) {
 		T tm(1, d);
-		tm.readDataFile(fp, true);
-		if (fclose(fp) != 0)
-			die("fclose");
-		tm.saveDataDump(outputPath.c_str());
+		tm.setBucketWidth(bucketWidth);	// timestamps are kept while reading
+		if (inputs.empty())
+			tm.readDataFile(stdin, true);
+		else
+			tm.readDataFiles(inputs);	// one thread per file
+		tm.setDumpFlags(flags);
+		if (append)
+			tm.appendDataDump(outputPath.c_str());	// as a new chunk
+		else
+			tm.saveDataDump(outputPath.c_str());
+	}
+
+	static void compact(size_t d, std::string path) {
+		T tm(1, d);
+		tm.compactDataDump(path.c_str());
 	}
 };
 
@@ -43,7 +58,12 @@ int main(int argc, char **argv) {
 	positional_options_description arguments;
 	description.add_options()("help,h", "show help");
 	options.add_options()
-		("input,f", value<std::string>(), "input CSV file path")
+		("input,f", value<std::vector<std::string>>()->multitoken(), "input CSV file paths or glob patterns (default: stdin)")
+		("dist", value<std::string>()->default_value("poisson"), "value type of the estimation: poisson (integers) or gamma (reals)")
+		("packed,p", "bit-pack the records of each segment (smaller dump)")
+		("bucket", value<size_t>(), "group records by time buckets of this many seconds (needs a timestamp column)")
+		("append,a", "add the records to the existing dump as a new chunk (same -p and --bucket as before)")
+		("compact", "merge the chunks of the dump into one instead of reading CSV")
 		("dimension", value<size_t>(), "data dimension")
 		("output", value<std::string>(), "output dump file path");
 	arguments.add("dimension", 1);
@@ -52,7 +72,7 @@ int main(int argc, char **argv) {
 	description.add(options);
 
 	/* parse parameters from command-line arguments */
-	FILE *fp = stdin;
+	std::vector<std::string> inputs;
 	size_t d;
 	std::string outputPath;
 	variables_map vm;
@@ -69,16 +89,53 @@ int main(int argc, char **argv) {
 			exit(0);
 		}
 
-		if (vm.count("input")) {
-			fp = fopen(vm["input"].as<std::string>().c_str(), "r");
-			if (fp == NULL)
-				die("fopen");
-		}
+		if (vm.count("input"))
+			inputs = vm["input"].as<std::vector<std::string>>();
 
 		d = vm["dimension"].as<size_t>();
 		outputPath = vm["output"].as<std::string>();
 
-		CSV2Dump<PoissonMixtureModel>::csv2dump(d, fp, outputPath);
+		size_t flags = DUMP_STATS;	// for a quick start of estimate
+		if (vm.count("packed"))
+			flags |= DUMP_PACKED;
+		size_t bucketWidth = 0;
+		if (vm.count("bucket")) {
+			bucketWidth = vm["bucket"].as<size_t>();
+			if (bucketWidth == 0) {
+				std::cerr << "--bucket must be positive." << std::endl;
+				exit(1);
+			}
+			flags |= DUMP_BUCKETED;
+		}
+
+		bool append = vm.count("append");
+		if (append && vm.count("compact")) {
+			std::cerr << "--append and --compact are exclusive." << std::endl;
+			exit(1);
+		}
+
+		std::string dist = vm["dist"].as<std::string>();
+		if (vm.count("compact") && dist == "poisson") {
+			CSV2Dump<PoissonMixtureModel>::compact(d, outputPath);
+		} else if (vm.count("compact") && dist == "gamma") {
+			CSV2Dump<GammaMixtureModel>::compact(d, outputPath);
+		} else if (dist == "poisson") {
+			CSV2Dump<PoissonMixtureModel>::csv2dump(d, inputs, outputPath,
+					flags, bucketWidth, append);
+		} else if (dist == "gamma") {
+			if (flags & DUMP_PACKED) {
+				std::cerr << "--packed is not supported with --dist gamma." << std::endl;
+				exit(1);
+			}
+			CSV2Dump<GammaMixtureModel>::csv2dump(d, inputs, outputPath,
+					flags, bucketWidth, append);
+		} else {
+			std::cerr << "unknown --dist: " << dist << std::endl;
+			exit(1);
+		}
+	} catch (PmmError &e) {
+		std::cerr << e.what() << std::endl;
+		exit(1);
 	} catch (std::exception &e) {
 		std::cout << e.what() << std::endl;
 		exit(1);
@@ -20,45 +20,398 @@
 #include <iostream>
 #include <chrono>
 #include <time.h>
+#include <unistd.h>
+#include <sys/wait.h>
 #include <boost/program_options.hpp>
+#ifdef _OPENMP
+#include <omp.h>
+#endif
 #include "class/PoissonMixtureModel.h"
+#include "class/GammaMixtureModel.h"
+#include "class/Channel.h"
+#include "class/PmmError.h"
 #include "lib/util.h"
 
 using namespace std::chrono;
 using namespace boost::program_options;
 
+/* settings of an estimation run */
+struct EstimateOptions {
+	size_t k, d, nItr, nThres;
+	std::string dumpPath;
+	bool fixedItr, doSrand;
+	bool outOfCore;	// stream the dump file in every iteration
+	size_t bufferSize;	// MiB of I/O buffers for outOfCore
+	size_t nShards;	// number of worker processes (0: none)
+	std::string socketPath;	// Unix socket between coordinator and workers
+	bool isWorker;	// run as the worker of shard shardIndex
+	size_t shardIndex;
+	std::string init;	// initialization of the distribution parameters
+	double lazyTol;	// skip segments whose theta moved less than this (0: off)
+	size_t fullPassEvery;	// recompute all segments this often with lazyTol
+	double sparseTheta;	// prune components with smaller theta (0: off)
+	size_t reactivateEvery;	// re-check pruned components this often
+	int64_t from, to;	// time range [from, to) of records to use
+	std::string checkpointPath;	// write checkpoints here (empty: never)
+	size_t checkpointEvery;	// iterations between checkpoints
+	std::string resumePath;	// continue from this checkpoint
+	std::string dist;	// component distribution
+	std::string thetaPath;	// binary theta output instead of text rows
+	std::vector<std::string> inputs;	// csv files instead of stdin
+	size_t miniBatch;	// segments per mini-batch (0: no mini-batch EM)
+	size_t miniBatchItr;	// mini-batch iterations before the full ones
+	double stepDecay;	// step size decay of mini-batch EM
+	size_t memoryBudget;	// MiB for the data and EM (0: no limit)
+	bool affinity;	// fixed segment-to-thread assignment, first-touch placement
+	bool pinThreads;	// pin each OpenMP thread to one CPU
+	bool pipelined;	// the first EM iteration runs while the dump is read
+	size_t nSlots;	// models of a bank, one per slot of the period (0: one model)
+	int64_t period;	// seconds of the period the slots divide
+};
+
+static const char *strategyNames[] = { "gamma", "fused", "outOfCore" };
+
+static std::string mib(size_t bytes) {
+	char buf[32];
+	snprintf(buf, sizeof(buf), "%.1f MiB", (double) bytes / (1 << 20));
+	return buf;
+}
+
+static void printMemory(const std::string& label, const MemoryUsage& m) {
+	std::cerr << label << ": values " << mib(m.values) << ", gamma "
+			<< mib(m.gamma) << ", segments " << mib(m.segments)
+			<< ", scratch " << mib(m.scratch) << ", total " << mib(m.total())
+			<< std::endl;
+}
+
+/*
+ * Convergence test of EM, after the second iteration: the log-likelihood
+ * changed by less than 0.1% three times in a row (counted by nConv).
+ */
+static bool converged(double prev, double now, size_t& nConv) {
+	if (fabs((now - prev) / now) < 0.001)	// the difference percentage is less than 1%
+		return ++nConv >= 3;	// for continuous 3 times
+	nConv = 0;
+	return false;
+}
+
 //T is a template parameter
 template<class T>
 class Estimator {
-public:
-	static void estimate(size_t k, size_t d, size_t nItr, size_t nThres,	//size_t = unsigned int(32-bit)/long unsigned int(64-bit)
-			std::string dumpPath, bool fixedItr, bool doSrand) {
-		std::cerr << "K = " << k << ", D = " << d << ", N_ITER = " << nItr
-				<< std::endl;
-		T tm(k, d, doSrand);
-		tm.setThres(nThres);
+private:
+	/* --pinThreads */
+	static void pin(const EstimateOptions& opt) {
+		if (opt.pinThreads && pinThreads() < 0)
+			die("sched_setaffinity");
+	}
 
-		/* load data */
-		if (dumpPath.empty()) {	// if not using dump file, but csv file
+	static void load(T& tm, const EstimateOptions& opt) {
+		if (!opt.inputs.empty()) {	// csv files, one thread each
+			tm.readDataFiles(opt.inputs);
+		} else if (opt.dumpPath.empty()) {	// if not using dump file, but csv file
 			tm.readDataFile(stdin, true);
+		} else if (opt.outOfCore) {	// stream the dump file in every iteration
+			tm.openDataStream(opt.dumpPath.c_str(), opt.bufferSize << 20);
 		} else {	// if using dumpfile
-			FILE *fp = fopen(dumpPath.c_str(), "rb");
+			FILE *fp = fopen(opt.dumpPath.c_str(), "rb");
 			if (fp == NULL)
 				die("fopen");
-			tm.loadDataDump(fp);
+			if (opt.pipelined) {
+				pin(opt);	// the first iteration runs here
+				tm.loadDataDumpWithEM(fp);
+			} else {
+				tm.loadDataDump(fp);
+			}
 			if (fclose(fp) != 0)
 				die("fclose");
 		}
+	}
+
+	/*
+	 * The first of candidates whose estimate fits in the budget.  The I/O
+	 * buffers of out-of-core are shrunk (in whole MiB) to what is left.
+	 */
+	static MemoryStrategy chooseStrategy(T& tm, EstimateOptions& opt,
+			const std::vector<MemoryStrategy>& candidates, size_t nSegs,
+			size_t nRecords, size_t maxRecords) {
+		size_t budget = opt.memoryBudget << 20;
+		std::cerr << "memory budget " << mib(budget) << " for " << nSegs
+				<< " segments, " << nRecords << " records" << std::endl;
+		for (MemoryStrategy st : candidates) {
+			size_t bufferSize = opt.bufferSize;
+			MemoryUsage m = tm.estimateMemory(st, nSegs, nRecords, maxRecords,
+					bufferSize << 20);
+			if (st == MEMORY_STREAM && m.total() > budget) {
+				size_t over = (m.total() - budget + (1 << 20) - 1) >> 20;
+				bufferSize = (bufferSize > over + 1) ? bufferSize - over : 1;
+				m = tm.estimateMemory(st, nSegs, nRecords, maxRecords,
+						bufferSize << 20);
+			}
+			printMemory(strategyNames[st], m);
+			if (m.total() <= budget) {
+				std::cerr << "memory strategy: " << strategyNames[st] << std::endl;
+				opt.bufferSize = bufferSize;
+				return st;
+			}
+		}
+		std::cerr << "no memory strategy fits in --memoryBudget "
+				<< opt.memoryBudget << " MiB";
+		if (opt.dumpPath.empty())
+			std::cerr << " (--outOfCore needs a dump file)";
+		else if (tm.getDumpFlags() & DUMP_CHUNKED)
+			std::cerr << " (--outOfCore needs a compacted dump, csv2dump --compact)";
+		std::cerr << "." << std::endl;
+		exit(1);
+	}
+
+	/*
+	 * load() within opt.memoryBudget, holding the data in the first way
+	 * that fits: with stored responsibilities, with fused E- and M-steps,
+	 * or out-of-core.  A dump is measured before it is loaded; CSV input is
+	 * read without responsibilities, stopping as soon as it cannot fit even
+	 * so, and measured afterwards.
+	 */
+	static void loadWithinBudget(T& tm, EstimateOptions& opt) {
+		std::vector<MemoryStrategy> candidates;
+		if (!opt.outOfCore) {
+			candidates.push_back(MEMORY_GAMMA);
+			candidates.push_back(MEMORY_FUSED);
+		}
+		size_t nSegs, nRecords, maxRecords;
+		if (!opt.dumpPath.empty()) {
+			tm.measureDump(opt.dumpPath.c_str(), nSegs, nRecords, maxRecords);
+			/* out-of-core needs a compacted dump */
+			if (opt.lazyTol == 0.0 && opt.miniBatch == 0
+					&& !(tm.getDumpFlags() & DUMP_CHUNKED))
+				candidates.push_back(MEMORY_STREAM);
+			MemoryStrategy st = chooseStrategy(tm, opt, candidates, nSegs,
+					nRecords, maxRecords);
+			tm.setStoreGamma(st == MEMORY_GAMMA);
+			opt.outOfCore = (st == MEMORY_STREAM);
+			opt.pipelined = opt.pipelined && !opt.outOfCore;
+			load(tm, opt);
+		} else {
+			tm.setStoreGamma(false);
+			tm.setReadBudget(opt.memoryBudget << 20);
+			load(tm, opt);
+			tm.measureData(nSegs, nRecords, maxRecords);
+			MemoryStrategy st = chooseStrategy(tm, opt, candidates, nSegs,
+					nRecords, maxRecords);
+			tm.setStoreGamma(st == MEMORY_GAMMA);
+		}
+		printMemory("memory in use", tm.memoryUsage());
+	}
+
+	/*
+	 * Pin the threads, then let each place the segments it works on.  When
+	 * the first iteration runs while loading, load() has pinned them.
+	 */
+	static void place(T& tm, const EstimateOptions& opt) {
+		if (!opt.pipelined)
+			pin(opt);
+		if (opt.affinity)
+			tm.setAffinity(true);
+	}
+
+	/* load a shard and serve the coordinator */
+	static void work(const EstimateOptions& opt, size_t index, Channel& ch) {
+		T tm(opt.k, opt.d, opt.doSrand);
+		tm.setThres(opt.nThres);
+		tm.setLazy(opt.lazyTol, opt.fullPassEvery);
+		tm.setSparse(opt.sparseTheta, opt.reactivateEvery);
+		tm.setTimeRange(opt.from, opt.to);
+		tm.setShard(index, opt.nShards);
+		load(tm, opt);
 		tm.validateDataset();
+		place(tm, opt);
+		tm.serveShard(ch);
+	}
+
+	/* start or wait for the workers and hand them to tm */
+	static void coordinate(T& tm, const EstimateOptions& opt,
+			std::vector<Channel*>& shards, std::vector<pid_t>& children) {
+		if (opt.socketPath.empty()) {
+			/* fork local workers connected by socket pairs */
+			for (size_t i = 0; i < opt.nShards; i++) {
+				Channel *mine, *theirs;
+				Channel::createPair(mine, theirs);
+				pid_t pid = fork();
+				if (pid < 0)
+					die("fork");
+				if (pid == 0) {
+					for (size_t j = 0; j < shards.size(); j++)
+						delete shards[j];
+					delete mine;
+					work(opt, i, *theirs);
+					delete theirs;
+					exit(0);
+				}
+				delete theirs;
+				shards.push_back(mine);
+				children.push_back(pid);
+			}
+		} else {
+			/* workers are started separately with --shardIndex */
+			int fd = Channel::listenUnix(opt.socketPath.c_str());
+			for (size_t i = 0; i < opt.nShards; i++) {
+				shards.push_back(Channel::acceptUnix(fd));
+			}
+			close(fd);
+			unlink(opt.socketPath.c_str());
+		}
+		tm.attachShards(shards);
+	}
+
+	/* EM on tm until convergence as in estimate(); the last log-likelihood */
+	static double fit(T& tm, const EstimateOptions& opt, size_t& nItr) {
+		double prev = DBL_MIN, now = 0.0;
+		size_t n_conv = 0;
+		nItr = 0;
+		for (size_t i = 0; i < opt.nItr; i++) {
+			tm.EMAlgorithm();
+			now = tm.logLikelihood();
+			nItr = i + 1;
+			if (!opt.fixedItr && i > 0 && converged(prev, now, n_conv))
+				break;
+			prev = now;
+		}
+		return now;
+	}
+
+public:
+	/*
+	 * A bank of opt.nSlots models, one per slot of opt.period seconds (e.g.
+	 * hour of week), trained from one pass over the dump and written one
+	 * after another (see bin/pmmbank).  A slot without segments gets a
+	 * model without components.
+	 */
+	static void estimateBank(const EstimateOptions& opt) {
+		typedef typename T::TopicModel Model;
+		std::cerr << "K = " << opt.k << ", D = " << opt.d << ", N_ITER = "
+				<< opt.nItr << ", slots = " << opt.nSlots << std::endl;
+		std::vector<T*> bank(opt.nSlots);
+		std::vector<Model*> models(opt.nSlots);
+		for (size_t j = 0; j < opt.nSlots; j++) {
+			bank[j] = new T(opt.k, opt.d, opt.doSrand);
+			bank[j]->setThres(opt.nThres);
+			bank[j]->setLazy(opt.lazyTol, opt.fullPassEvery);
+			bank[j]->setSparse(opt.sparseTheta, opt.reactivateEvery);
+			models[j] = bank[j];
+		}
+
+		/* one pass over the dump */
+		T reader(opt.k, opt.d, opt.doSrand);
+		reader.setTimeRange(opt.from, opt.to);
+		FILE *fp = fopen(opt.dumpPath.c_str(), "rb");
+		if (fp == NULL)
+			die("fopen");
+		reader.splitDataDump(fp, opt.period, models);
+		if (fclose(fp) != 0)
+			die("fclose");
+
+		auto start = system_clock::now();
+		for (size_t j = 0; j < opt.nSlots; j++) {
+			T& tm = *bank[j];
+			if (tm.numberOfSegments() == 0) {
+				std::cerr << "slot " << j << ": no segments, empty model"
+						<< std::endl;
+				continue;
+			}
+			tm.validateDataset();
+			tm.initDistParams(opt.init);
+			size_t nItr;
+			double now = fit(tm, opt, nItr);
+			std::cerr << "slot " << j << ": " << tm.numberOfSegments()
+					<< " segments, " << nItr << " iterations, log-likelihood "
+					<< now << std::endl;
+		}
+		std::cerr << "elapsed real time: "
+				<< duration_cast<microseconds>(system_clock::now() - start).count()
+						* 1e-6 << "s" << std::endl;
+
+		std::cout << "# of Slots : " << opt.nSlots << std::endl;
+		std::cout << "Period : " << opt.period << std::endl;
+		for (size_t j = 0; j < opt.nSlots; j++) {
+			std::cout << "Slot : " << j << std::endl;
+			if (bank[j]->numberOfSegments() > 0) {
+				bank[j]->dump();
+			} else {	/* no components and no segments */
+				std::cout << "# of Mixture : 0" << std::endl;
+				std::cout << "Dimension : " << opt.d << std::endl;
+				std::cout << "lambda" << std::endl << std::endl;
+				std::cout << "id,Ns,theta1,theta2,..." << std::endl;
+			}
+			delete bank[j];
+		}
+	}
+
+	static void estimate(EstimateOptions opt) {
+		if (opt.isWorker) {
+			Channel *ch = Channel::connectUnix(opt.socketPath.c_str());
+			work(opt, opt.shardIndex, *ch);
+			delete ch;
+			return;
+		}
+
+		std::cerr << "K = " << opt.k << ", D = " << opt.d << ", N_ITER = "
+				<< opt.nItr << std::endl;
+		T tm(opt.k, opt.d, opt.doSrand);
+		tm.setThres(opt.nThres);
+		tm.setLazy(opt.lazyTol, opt.fullPassEvery);
+		tm.setSparse(opt.sparseTheta, opt.reactivateEvery);
+		tm.setTimeRange(opt.from, opt.to);
+		tm.setThetaOutput(opt.thetaPath);
+		size_t nMini = 0;	// iterations [0, nMini) are mini-batch ones
+		if (opt.miniBatch > 0) {
+			tm.setMiniBatch(opt.miniBatch, opt.stepDecay);
+			nMini = opt.miniBatchItr;
+		}
+
+		/* load data */
+		auto launch = std::chrono::system_clock::now();
+		std::vector<Channel*> shards;
+		std::vector<pid_t> children;
+		if (opt.nShards > 0) {
+			coordinate(tm, opt, shards, children);
+		} else {
+			if (opt.memoryBudget > 0)
+				loadWithinBudget(tm, opt);	// may switch to --outOfCore
+			else
+				load(tm, opt);
+			tm.validateDataset();
+			place(tm, opt);
+			if (opt.resumePath.empty())
+				tm.initDistParams(opt.init);
+		}
 		tm.printDataStats();
 
-		/* EM! */
+		/* continue an interrupted run */
 		double prev, now;	// previous log-likelihood and current log-likelihood
-		size_t n_conv = 0;
+		size_t n_conv = 0, first = 0;
+		std::vector<double> history;	// log-likelihood of each iteration
+		prev = DBL_MIN;
+		if (!opt.resumePath.empty()) {
+			Checkpoint c;
+			c.read(opt.resumePath.c_str());
+			tm.restoreCheckpoint(c);
+			first = c.iteration;
+			n_conv = c.nConverged;
+			history.swap(c.loglik);
+			for (size_t i = 0; i < history.size(); i++) {
+				std::cerr << i + 1 << " " << history[i] << " "
+						<< history[i] - prev << std::endl;
+				prev = history[i];
+			}
+			std::cerr << "resumed after iteration " << first << std::endl;
+			if (!opt.fixedItr && n_conv >= 3)
+				first = nMini + opt.nItr;	// converged already
+		}
+		CheckpointWriter checkpoints(opt.checkpointPath);
+
+		/* EM! */
 		auto start = std::chrono::system_clock::now();
 		clock_t start_c = clock();
-		prev = DBL_MIN;
-		for (size_t i = 0; i < nItr; i++) {
+		for (size_t i = first; i < nMini + opt.nItr; i++) {
 #ifdef debug	//output debug info
 			std::cerr << std::endl;
 			for (size_t k = 0; k < hb.K; k++) {
@@ -68,21 +421,42 @@ public:
 				std::cerr << std::endl;
 			}
 #endif
-			tm.EMAlgorithm();
-			now = tm.logLikelihood();
+			if (i < nMini) {
+				/* estimate from a sample; full iterations polish it */
+				now = tm.miniBatchEMAlgorithm();
+			} else if (opt.outOfCore && opt.nShards == 0) {
+				/* one pass per iteration; log-likelihood before the update */
+				now = tm.streamEMAlgorithm();
+			} else {
+				if (i > 0 || !opt.pipelined)	// else done while loading
+					tm.EMAlgorithm();
+				now = tm.logLikelihood();
+			}
 			std::cerr << i + 1 << " " << now << " " << now - prev << std::endl;
-			if (!fixedItr && i > 0) {
-				/* convergence test */
-				if (fabs((now - prev) / now) < 0.001) {	// the difference percentage is less than 1%
-					if (++n_conv >= 3) {	// for continuous 3 times
-						break;
-					}
-				} else {
-					n_conv = 0;
-				}
+			if (i == 0) {
+				std::cerr << "time to first iteration: "
+						<< duration_cast<microseconds>(system_clock::now()
+								- launch).count() * 1e-6 << "s" << std::endl;
 			}
+			history.push_back(now);
+			bool done = !opt.fixedItr && i > nMini
+					&& converged(prev, now, n_conv);
 			prev = now;
+			if (!opt.checkpointPath.empty() && (done
+					|| i + 1 == nMini + opt.nItr
+					|| (i + 1) % opt.checkpointEvery == 0)) {
+				/* snapshot now, write in the background */
+				Checkpoint c;
+				tm.saveCheckpoint(c);
+				c.iteration = i + 1;
+				c.nConverged = n_conv;
+				c.loglik = history;
+				checkpoints.submit(c);
+			}
+			if (done)
+				break;
 		}
+		checkpoints.finish();
 		auto end = system_clock::now();
 		clock_t end_c = clock();
 		std::cerr << "elapsed real time: "
@@ -91,10 +465,29 @@ public:
 		std::cerr << "elapsed CPU time: "
 				<< (double) (end_c - start_c) / CLOCKS_PER_SEC << "s"
 				<< std::endl;
+		int nThreads = 1;
+#ifdef _OPENMP
+		nThreads = omp_get_max_threads();
+#endif
+		PhaseTimes pt = tm.getPhaseTimes();
+		std::cerr << "phase times with " << nThreads << " threads: E-step "
+				<< pt.estep << "s, M-step " << pt.mstep << "s, log-likelihood "
+				<< pt.loglik << "s" << std::endl;
 
 		/* print result */
-		tm.dump();
-		tm.AIC();
+		if (opt.nShards > 0) {
+			/* AIC still needs the workers; theta is collected afterwards */
+			tm.AIC();
+			tm.detachShards();
+			for (size_t i = 0; i < shards.size(); i++)
+				delete shards[i];
+			for (size_t i = 0; i < children.size(); i++)
+				waitpid(children[i], NULL, 0);
+			tm.dump();
+		} else {
+			tm.dump();
+			tm.AIC();
+		}
 	}
 };
 
@@ -107,11 +500,38 @@ int main(int argc, char **argv) {
 	description2.add_options()
 		("noSrand,f", "do not srand() (for debug)")	//srand() is used to provide seeds for rand() funcion
 		("dumpPath,b", value<std::string>(), "use dump file instead of csv file")
+		("input", value<std::vector<std::string>>()->multitoken(), "read these csv files or glob patterns instead of stdin")
 		("dim,d", value<size_t>()->default_value(1), "data dimension")	//only speed
 		("nmix,k", value<size_t>()->default_value(4), "number of mixture")	// number of traffic states
+		("dist", value<std::string>()->default_value("poisson"), "component distribution: poisson (integer values) or gamma (positive real values)")
 		("maxItr,i", value<size_t>()->default_value(20), "maximum number of iterations")
 		("fixedItr,c", "fix the number of iterations")
-		("minData,t", value<size_t>()->default_value(1), "minimum number of records per segment"); // what is it used for
+		("outOfCore", "stream the dump file in each iteration instead of loading it (requires -b)")
+		("bufferSize", value<size_t>()->default_value(256), "I/O buffer budget in MiB for --outOfCore")
+		("noPipeline", "load the whole dump before the first EM iteration instead of overlapping them")
+		("slots", value<size_t>()->default_value(0), "train a bank of this many models, one per slot of --period, from a bucketed dump (0: one model)")
+		("period", value<int64_t>()->default_value(604800), "seconds of the period the --slots divide (default: a week)")
+		("affinity", "give each thread fixed segments, and place their records in its NUMA node")
+		("pinThreads", "pin each thread to one CPU (of those allowed by taskset or numactl)")
+		("memoryBudget", value<size_t>()->default_value(0), "keep the data and EM within this many MiB, choosing how to hold the records (0: no limit)")
+		("shards", value<size_t>(), "split the dump into this many shards, one worker process each (requires -b)")
+		("socket", value<std::string>(), "Unix socket to reach the workers, which are then started separately")
+		("shardIndex", value<size_t>(), "run as the worker of this shard (with --shards and --socket)")
+		("minData,t", value<size_t>()->default_value(1), "minimum number of records per segment") // what is it used for
+		("init", value<std::string>()->default_value("uniform"), "initial lambdas: uniform (random), quantile or kmeans")
+		("lazyTol", value<double>()->default_value(0.0), "skip segments whose mixing coefficients changed less than this (0: never)")
+		("fullPassEvery", value<size_t>()->default_value(10), "recompute all segments every this many iterations with --lazyTol")
+		("sparseTheta", value<double>()->default_value(0.0), "drop components whose mixing coefficient falls below this (0: never)")
+		("reactivateEvery", value<size_t>()->default_value(10), "re-check dropped components every this many iterations with --sparseTheta")
+		("from", value<int64_t>(), "use only records at or after this time (seconds; needs timestamps)")
+		("to", value<int64_t>(), "use only records before this time (seconds; needs timestamps)")
+		("checkpoint", value<std::string>(), "write the EM state to this file periodically")
+		("checkpointEvery", value<size_t>()->default_value(10), "iterations between checkpoints")
+		("miniBatch", value<size_t>()->default_value(0), "run mini-batch EM on this many random segments per iteration first (0: never)")
+		("miniBatchItr", value<size_t>()->default_value(50), "number of mini-batch iterations before the -i full ones")
+		("stepDecay", value<double>()->default_value(0.6), "step size of mini-batch t is (t + 1)^-stepDecay, in (0.5, 1]")
+		("thetaBinary", value<std::string>(), "write the mixing coefficients to this file in binary instead of to stdout")
+		("resume", value<std::string>(), "continue the run saved in this checkpoint (same data and options)");
 	description1.add(description2);
 
 	/* parse parameters from command-line arguments */
@@ -129,23 +549,153 @@ int main(int argc, char **argv) {
 			exit(0);
 		}
 
-		bool doSrand = true;
-		bool fixedItr = false;
-		std::string dumpPath;
-		if (vm.count("fixedItr"))
-			fixedItr = true;
-		if (vm.count("noSrand"))
-			doSrand = false;
+		EstimateOptions opt;
+		opt.doSrand = !vm.count("noSrand");
+		opt.fixedItr = vm.count("fixedItr");
 		if (vm.count("dumpPath"))
-			dumpPath = vm["dumpPath"].as<std::string>();
+			opt.dumpPath = vm["dumpPath"].as<std::string>();
+		opt.outOfCore = vm.count("outOfCore");
+		if (opt.outOfCore && opt.dumpPath.empty()) {
+			std::cerr << "--outOfCore requires a dump file (-b)." << std::endl;
+			exit(1);
+		}
+		opt.nShards = vm.count("shards") ? vm["shards"].as<size_t>() : 0;
+		if (opt.nShards > 0 && opt.dumpPath.empty()) {
+			std::cerr << "--shards requires a dump file (-b)." << std::endl;
+			exit(1);
+		}
+		if (vm.count("socket"))
+			opt.socketPath = vm["socket"].as<std::string>();
+		opt.isWorker = vm.count("shardIndex");
+		opt.shardIndex = opt.isWorker ? vm["shardIndex"].as<size_t>() : 0;
+		if (opt.isWorker && (opt.nShards == 0 || opt.socketPath.empty()
+				|| opt.shardIndex >= opt.nShards)) {
+			std::cerr << "--shardIndex requires --shards and --socket." << std::endl;
+			exit(1);
+		}
 
-		size_t k = vm["nmix"].as<size_t>();
-		size_t d = vm["dim"].as<size_t>();
-		size_t nItr = vm["maxItr"].as<size_t>();
-		size_t nThres = vm["minData"].as<size_t>();
+		opt.init = vm["init"].as<std::string>();
+		if (opt.init != "uniform" && opt.init != "quantile"
+				&& opt.init != "kmeans") {
+			std::cerr << "unknown --init: " << opt.init << std::endl;
+			exit(1);
+		}
+		if (opt.init != "uniform" && opt.nShards > 0) {
+			std::cerr << "--init " << opt.init
+					<< " is not supported with --shards." << std::endl;
+			exit(1);
+		}
+
+		opt.lazyTol = vm["lazyTol"].as<double>();
+		opt.fullPassEvery = vm["fullPassEvery"].as<size_t>();
+		if (opt.lazyTol < 0.0) {
+			std::cerr << "--lazyTol must not be negative." << std::endl;
+			exit(1);
+		}
+		if (opt.lazyTol > 0.0 && opt.outOfCore) {
+			std::cerr << "--lazyTol is not supported with --outOfCore." << std::endl;
+			exit(1);
+		}
+
+		opt.sparseTheta = vm["sparseTheta"].as<double>();
+		opt.reactivateEvery = vm["reactivateEvery"].as<size_t>();
+		if (opt.sparseTheta < 0.0 || opt.sparseTheta >= 1.0) {
+			std::cerr << "--sparseTheta must be in [0, 1)." << std::endl;
+			exit(1);
+		}
+
+		opt.miniBatch = vm["miniBatch"].as<size_t>();
+		opt.miniBatchItr = vm["miniBatchItr"].as<size_t>();
+		opt.stepDecay = vm["stepDecay"].as<double>();
+		if (opt.miniBatch > 0 && (opt.outOfCore || opt.nShards > 0)) {
+			std::cerr << "--miniBatch is not supported with --outOfCore or --shards." << std::endl;
+			exit(1);
+		}
+		if (opt.stepDecay <= 0.5 || opt.stepDecay > 1.0) {
+			std::cerr << "--stepDecay must be in (0.5, 1]." << std::endl;
+			exit(1);
+		}
+
+		opt.affinity = vm.count("affinity");
+		opt.pinThreads = vm.count("pinThreads");
+
+		opt.memoryBudget = vm["memoryBudget"].as<size_t>();
+		if (opt.memoryBudget > 0 && opt.nShards > 0) {
+			std::cerr << "--memoryBudget is not supported with --shards." << std::endl;
+			exit(1);
+		}
+
+		opt.from = vm.count("from") ? vm["from"].as<int64_t>() : INT64_MIN;
+		opt.to = vm.count("to") ? vm["to"].as<int64_t>() : INT64_MAX;
+		if (opt.from >= opt.to) {
+			std::cerr << "--from must be before --to." << std::endl;
+			exit(1);
+		}
 
-		Estimator<PoissonMixtureModel>::estimate(k, d, nItr, nThres,
-				dumpPath, fixedItr, doSrand);
+		if (vm.count("checkpoint"))
+			opt.checkpointPath = vm["checkpoint"].as<std::string>();
+		opt.checkpointEvery = vm["checkpointEvery"].as<size_t>();
+		if (vm.count("resume"))
+			opt.resumePath = vm["resume"].as<std::string>();
+		if (opt.checkpointEvery == 0) {
+			std::cerr << "--checkpointEvery must be positive." << std::endl;
+			exit(1);
+		}
+		if ((!opt.checkpointPath.empty() || !opt.resumePath.empty())
+				&& opt.nShards > 0) {
+			std::cerr << "--checkpoint and --resume are not supported with --shards." << std::endl;
+			exit(1);
+		}
+
+		if (vm.count("input")) {
+			if (vm.count("dumpPath")) {
+				std::cerr << "--input and -b are exclusive." << std::endl;
+				exit(1);
+			}
+			opt.inputs = vm["input"].as<std::vector<std::string>>();
+		}
+
+		/* the first iteration can run while loading if it needs no data before */
+		opt.pipelined = !vm.count("noPipeline") && !opt.dumpPath.empty()
+				&& !opt.outOfCore && opt.nShards == 0 && opt.init == "uniform"
+				&& opt.resumePath.empty() && opt.miniBatch == 0;
+
+		if (vm.count("thetaBinary"))
+			opt.thetaPath = vm["thetaBinary"].as<std::string>();
+
+		opt.k = vm["nmix"].as<size_t>();
+		opt.d = vm["dim"].as<size_t>();
+		opt.nItr = vm["maxItr"].as<size_t>();
+		opt.nThres = vm["minData"].as<size_t>();
+		opt.bufferSize = vm["bufferSize"].as<size_t>();
+
+		opt.nSlots = vm["slots"].as<size_t>();
+		opt.period = vm["period"].as<int64_t>();
+		if (opt.nSlots > 0 && (opt.dumpPath.empty() || opt.d != 1
+				|| opt.outOfCore || opt.nShards > 0 || opt.memoryBudget > 0
+				|| opt.miniBatch > 0 || !opt.checkpointPath.empty()
+				|| !opt.resumePath.empty() || !opt.thetaPath.empty())) {
+			std::cerr << "--slots requires a dump file (-b) and -d 1, and supports none of --outOfCore, --shards, --memoryBudget, --miniBatch, --checkpoint, --resume and --thetaBinary." << std::endl;
+			exit(1);
+		}
+
+		opt.dist = vm["dist"].as<std::string>();
+		if (opt.dist != "poisson" && opt.nSlots > 0) {
+			std::cerr << "--slots supports only --dist poisson (bin/pmmbank scores Poisson mixtures)." << std::endl;
+			exit(1);
+		} else if (opt.nSlots > 0) {
+			Estimator<PoissonMixtureModel>::estimateBank(opt);
+		} else if (opt.dist == "poisson") {
+			Estimator<PoissonMixtureModel>::estimate(opt);
+		} else if (opt.dist == "gamma") {
+			Estimator<GammaMixtureModel>::estimate(opt);
+		} else {
+			std::cerr << "unknown --dist: " << opt.dist << std::endl;
+			exit(1);
+		}
+	} catch (PmmError &e) {
+		std::cerr << e.what() << std::endl;
+		exit(1);
 	} catch (std::exception &e) {
 		std::cout << e.what() << std::endl;
 		exit(1);
@@ -0,0 +1,290 @@
+/*
+ * kernelcheck.cpp - compare the Poisson pdf kernels with the reference one
+ *
+ * Copyright (C) 2016  Akira Kinoshita <kinoshita@nii.ac.jp>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <iostream>
+#include <cmath>
+#include <climits>
+#include <cstdio>
+#include <string>
+#include <vector>
+#include <random>
+#include <algorithm>
+#include <boost/program_options.hpp>
+#include "class/PoissonMixtureModel.h"
+#include "class/Checkpoint.h"
+#include "class/PmmError.h"
+
+using namespace boost::program_options;
+
+/*
+ * Tolerances.  Every kernel evaluates the same expression as the reference,
+ * so the differences are rounding only; EM may amplify them a little from
+ * iteration to iteration, hence the looser bounds on the estimates.
+ *   log pdf          |a - b| <= 1e-12 * max(1, |a|)
+ *   log-likelihood   |a - b| <= 1e-10 * max(1, |a|), after every iteration
+ *   lambda           |a - b| <= 1e-9 * max(1e-300, |a|)
+ *   theta, gamma     |a - b| <= 1e-9
+ */
+static const double tolLogPdf = 1e-12;
+static const double tolLoglik = 1e-10;
+static const double tolLambda = 1e-9;
+static const double tolProb = 1e-9;
+
+/* the kernels to check against POISSON_KERNEL_GSL */
+static const struct {
+	const char *name;
+	PoissonKernel kernel;
+} kernels[] = {
+	{ "table", POISSON_KERNEL_TABLE },
+};
+
+/* a data set; lambdas (if any) replace the quantile initialization */
+struct Scenario {
+	std::string name;
+	size_t K;
+	std::vector<std::string> ids;
+	std::vector<int> x;
+	std::vector<double> lambdas;
+};
+
+static double relativeError(double a, double b, double floor) {
+	return std::fabs(a - b) / std::max(floor, std::fabs(a));
+}
+
+/* records of nSegs segments with 1..maxSize records drawn from means */
+static void generate(Scenario& sc, std::mt19937& rng, size_t nSegs,
+		size_t maxSize, const std::vector<double>& means) {
+	std::uniform_int_distribution<size_t> size(1, maxSize);
+	std::uniform_int_distribution<size_t> pick(0, means.size() - 1);
+	for (size_t s = 0; s < nSegs; s++) {
+		std::string id = sc.name + std::to_string(s);
+		size_t n = size(rng);
+		double mean = means[pick(rng)];
+		for (size_t i = 0; i < n; i++) {
+			int v;
+			if (mean == 0.0) {	// poisson_distribution needs mean > 0
+				v = 0;
+			} else if (mean < 1e9) {
+				std::poisson_distribution<int> p(mean);
+				v = p(rng);
+			} else {	// keep within int
+				std::uniform_int_distribution<int> u((int) 1e9, INT_MAX);
+				v = u(rng);
+			}
+			sc.ids.push_back(id);
+			sc.x.push_back(v);
+		}
+	}
+}
+
+static void buildScenarios(std::vector<Scenario>& scs, unsigned int seed) {
+	std::mt19937 rng(seed);
+	Scenario sc;
+
+	sc = Scenario { "mixed", 3 };
+	generate(sc, rng, 300, 40, { 2.0, 20.0, 200.0 });
+	scs.push_back(sc);
+
+	sc = Scenario { "zeros", 2 };
+	generate(sc, rng, 50, 20, { 0.0 });
+	scs.push_back(sc);
+
+	sc = Scenario { "large", 3 };
+	generate(sc, rng, 100, 20, { 1e5, 1e7, 2e9 });
+	scs.push_back(sc);
+
+	sc = Scenario { "tiny", 3 };
+	generate(sc, rng, 100, 30, { 0.0, 1e-3 });
+	sc.lambdas = { 1e-12, 1e-6, 1e-3 };
+	scs.push_back(sc);
+
+	sc = Scenario { "k1", 1 };
+	generate(sc, rng, 100, 30, { 5.0, 50.0 });
+	scs.push_back(sc);
+
+	sc = Scenario { "single", 4 };
+	generate(sc, rng, 500, 1, { 1.0, 10.0, 100.0, 1000.0 });
+	scs.push_back(sc);
+}
+
+static void load(PoissonMixtureModel& tm, const Scenario& sc) {
+	std::vector<const char *> ids(sc.ids.size());
+	for (size_t i = 0; i < ids.size(); i++)
+		ids[i] = sc.ids[i].c_str();
+	tm.setThres(1);
+	tm.addRecords(ids.data(), sc.x.data(), ids.size());
+	tm.finishRecords();
+}
+
+/*
+ * Run nItr EM iterations with the reference and with the kernel from the
+ * same start and report the largest differences; false if out of tolerance.
+ */
+static bool checkEM(const Scenario& sc, const char *name,
+		PoissonKernel kernel, size_t nItr) {
+	PoissonMixtureModel ref(sc.K, 1, false), alt(sc.K, 1, false);
+	load(ref, sc);
+	load(alt, sc);
+	Checkpoint c;
+	if (sc.lambdas.empty())
+		ref.initDistParams("quantile");
+	ref.saveCheckpoint(c);
+	if (!sc.lambdas.empty()) {
+		c.params = sc.lambdas;
+		ref.restoreCheckpoint(c);
+	}
+	alt.restoreCheckpoint(c);
+	alt.setKernel(kernel);
+
+	double errLoglik = 0.0;
+	for (size_t i = 0; i < nItr; i++) {
+		ref.EMAlgorithm();
+		alt.EMAlgorithm();
+		errLoglik = std::max(errLoglik, relativeError(ref.logLikelihood(),
+				alt.logLikelihood(), 1.0));
+	}
+
+	size_t nParams = ref.numberOfDistParams();
+	std::vector<double> p1(nParams), p2(nParams);
+	ref.getDistParams(p1.data());
+	alt.getDistParams(p2.data());
+	double errLambda = 0.0;
+	for (size_t i = 0; i < nParams; i++)
+		errLambda = std::max(errLambda, relativeError(p1[i], p2[i], 1e-300));
+
+	/* theta of every segment, gamma of every record */
+	size_t nSegs = ref.numberOfSegments();
+	std::vector<double> t1(sc.K), t2(sc.K);
+	double errTheta = 0.0, errGamma = 0.0;
+	for (size_t s = 0; s < nSegs; s++) {
+		ref.getTheta(s, t1.data());
+		alt.getTheta(s, t2.data());
+		for (size_t k = 0; k < sc.K; k++)
+			errTheta = std::max(errTheta, std::fabs(t1[k] - t2[k]));
+	}
+	for (size_t i = 0; i < sc.x.size(); i++) {
+		const std::string& id = sc.ids[i];
+		size_t s = ref.findSegment(id.c_str(), id.size());
+		ref.scoreRecord(s, &sc.x[i], t1.data());
+		alt.scoreRecord(s, &sc.x[i], t2.data());
+		for (size_t k = 0; k < sc.K; k++)
+			errGamma = std::max(errGamma, std::fabs(t1[k] - t2[k]));
+	}
+
+	bool ok = errLoglik <= tolLoglik && errLambda <= tolLambda
+			&& errTheta <= tolProb && errGamma <= tolProb;
+	printf("%-8s %-6s K=%zu records=%zu loglik %.1e lambda %.1e theta %.1e gamma %.1e %s\n",
+			sc.name.c_str(), name, sc.K, sc.x.size(), errLoglik, errLambda,
+			errTheta, errGamma, ok ? "ok" : "FAILED");
+	return ok;
+}
+
+/*
+ * log pdf of single values on a grid of lambdas and counts, including the
+ * ends of both ranges (scoreRecord of a K = 1 model is the log pdf).
+ */
+static bool checkGrid(const char *name, PoissonKernel kernel) {
+	static const double lambdas[] = { 1e-300, 1e-12, 1e-3, 0.5, 1.0, 7.0,
+			100.0, 4095.0, 1e6, 1e9, 2e9 };
+	static const int counts[] = { 0, 1, 2, 3, 10, 100, 170, 171, 4095, 4096,
+			100000, 1000000, 1000000000, INT_MAX };
+	const char *id = "grid";
+	int one = 1;
+	PoissonMixtureModel ref(1, 1, false), alt(1, 1, false);
+	ref.setThres(1);
+	ref.addRecords(&id, &one, 1);
+	ref.finishRecords();
+	alt.setThres(1);
+	alt.addRecords(&id, &one, 1);
+	alt.finishRecords();
+	alt.setKernel(kernel);
+
+	double errMax = 0.0;
+	size_t nChecked = 0;
+	bool ok = true;
+	for (double lambda : lambdas) {
+		Checkpoint c;
+		ref.saveCheckpoint(c);
+		c.params.assign(1, lambda);
+		ref.restoreCheckpoint(c);
+		alt.restoreCheckpoint(c);
+		for (int x : counts) {
+			double a = ref.scoreRecord(1, &x, NULL);
+			double b = alt.scoreRecord(1, &x, NULL);
+			double err = relativeError(a, b, 1.0);
+			errMax = std::max(errMax, err);
+			++nChecked;
+			if (!(err <= tolLogPdf)) {
+				printf("grid     %-6s lambda=%g x=%d: %.17g vs %.17g\n",
+						name, lambda, x, a, b);
+				ok = false;
+			}
+		}
+	}
+	printf("%-8s %-6s values=%zu logpdf %.1e %s\n", "grid", name, nChecked,
+			errMax, ok ? "ok" : "FAILED");
+	return ok;
+}
+
+int main(int argc, char **argv) {
+	/* program options */
+	options_description description("General options");
+	options_description options("Program options");
+	description.add_options()("help,h", "show help");
+	options.add_options()
+		("maxItr,i", value<size_t>()->default_value(20), "EM iterations per data set")
+		("seed", value<unsigned int>()->default_value(1), "seed of the generated data sets");
+
+	description.add(options);
+
+	variables_map vm;
+	try {
+		store(command_line_parser(argc, argv).options(description).run(), vm);
+		notify(vm);
+
+		if (vm.count("help")) {
+			std::cout << "Usage: " << argv[0] << " [options]" << std::endl;
+			std::cout << description << std::endl;
+			exit(0);
+		}
+
+		size_t nItr = vm["maxItr"].as<size_t>();
+		std::vector<Scenario> scs;
+		buildScenarios(scs, vm["seed"].as<unsigned int>());
+
+		bool ok = true;
+		for (const auto& kn : kernels) {
+			ok = checkGrid(kn.name, kn.kernel) && ok;
+			for (const Scenario& sc : scs)
+				ok = checkEM(sc, kn.name, kn.kernel, nItr) && ok;
+		}
+		if (!ok) {
+			std::cerr << "some kernels are out of tolerance." << std::endl;
+			exit(1);
+		}
+	} catch (PmmError &e) {
+		std::cerr << e.what() << std::endl;
+		exit(1);
+	} catch (std::exception &e) {
+		std::cout << e.what() << std::endl;
+		exit(1);
+	}
+
+	return 0;
+}
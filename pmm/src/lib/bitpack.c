@@ -0,0 +1,160 @@
+/*
+ * bitpack.c
+ *
+ * Copyright (C) 2016  Akira Kinoshita <kinoshita@nii.ac.jp>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "bitpack.h"
+#include <stdint.h>
+#include <string.h>
+
+#define BITPACK_HEADER 5
+
+static size_t payloadBytes(size_t n, unsigned w) {
+	return (n * w + 7) / 8;
+}
+
+/* upper bound of the size of a packed block of n values */
+size_t bitpackBound(size_t n) {
+	return BITPACK_HEADER + payloadBytes(n, 32);
+}
+
+/* pack n values into out and return the number of bytes written */
+size_t bitpack(const int *in, size_t n, unsigned char *out) {
+	int32_t base = 0;
+	uint32_t range = 0;
+	unsigned w = 0;
+	size_t i;
+
+	if (n > 0) {
+		int32_t max = in[0];
+		base = in[0];
+		for (i = 1; i < n; i++) {
+			if (in[i] < base)
+				base = in[i];
+			if (in[i] > max)
+				max = in[i];
+		}
+		range = (uint32_t) max - (uint32_t) base;
+	}
+	while (w < 32 && (range >> w) != 0)
+		w++;
+	/* byte-aligned widths decode faster and cost little */
+	if (w > 4 && w < 8)
+		w = 8;
+	else if (w > 12 && w < 16)
+		w = 16;
+	else if (w > 24)
+		w = 32;
+
+	out[0] = (unsigned char) base;
+	out[1] = (unsigned char) ((uint32_t) base >> 8);
+	out[2] = (unsigned char) ((uint32_t) base >> 16);
+	out[3] = (unsigned char) ((uint32_t) base >> 24);
+	out[4] = (unsigned char) w;
+	out += BITPACK_HEADER;
+
+	size_t bytes = payloadBytes(n, w);
+	memset(out, 0, bytes);
+	switch (w) {
+	case 0:
+		break;
+	case 8:
+		for (i = 0; i < n; i++)
+			out[i] = (unsigned char) (in[i] - base);
+		break;
+	case 16:
+		for (i = 0; i < n; i++) {
+			uint32_t v = (uint32_t) in[i] - (uint32_t) base;
+			out[2 * i] = (unsigned char) v;
+			out[2 * i + 1] = (unsigned char) (v >> 8);
+		}
+		break;
+	default:
+		for (i = 0; i < n; i++) {
+			uint64_t v = (uint64_t) ((uint32_t) in[i] - (uint32_t) base);
+			size_t bit = i * w;
+			unsigned shift = bit & 7;
+			unsigned char *p = out + (bit >> 3);
+			v <<= shift;
+			for (unsigned b = 0; b * 8 < w + shift; b++)
+				p[b] |= (unsigned char) (v >> (8 * b));
+		}
+		break;
+	}
+	return BITPACK_HEADER + bytes;
+}
+
+/*
+ * Unpack n values of a block of the given size into out.
+ * Returns 0 on success, or -1 if the block is malformed.
+ *
+ * The loops for the common widths have no dependencies between iterations
+ * so that the compiler can vectorize them.
+ */
+int bitunpack(const unsigned char *in, size_t bytes, size_t n, int *out) {
+	size_t i;
+	if (bytes < BITPACK_HEADER)
+		return -1;
+	uint32_t base = (uint32_t) in[0] | ((uint32_t) in[1] << 8)
+			| ((uint32_t) in[2] << 16) | ((uint32_t) in[3] << 24);
+	unsigned w = in[4];
+	if (w > 32 || bytes != BITPACK_HEADER + payloadBytes(n, w))
+		return -1;
+	in += BITPACK_HEADER;
+	bytes -= BITPACK_HEADER;
+
+	switch (w) {
+	case 0:
+		for (i = 0; i < n; i++)
+			out[i] = (int) base;
+		break;
+	case 8:
+		for (i = 0; i < n; i++)
+			out[i] = (int) (base + in[i]);
+		break;
+	case 16:
+		for (i = 0; i < n; i++)
+			out[i] = (int) (base + (in[2 * i] | ((uint32_t) in[2 * i + 1] << 8)));
+		break;
+	case 32:
+		for (i = 0; i < n; i++)
+			out[i] = (int) (base + (in[4 * i] | ((uint32_t) in[4 * i + 1] << 8)
+					| ((uint32_t) in[4 * i + 2] << 16)
+					| ((uint32_t) in[4 * i + 3] << 24)));
+		break;
+	default: {
+		/* 64-bit little-endian loads while they stay inside the block */
+		uint64_t mask = ((uint64_t) 1 << w) - 1;
+		size_t safe = (bytes >= 8) ? ((bytes - 8) * 8) / w : 0;
+		for (i = 0; i < n && i <= safe; i++) {
+			size_t bit = i * w;
+			uint64_t v;
+			memcpy(&v, in + (bit >> 3), 8);
+			out[i] = (int) (base + (uint32_t) ((v >> (bit & 7)) & mask));
+		}
+		for (; i < n; i++) {
+			size_t bit = i * w;
+			uint64_t v = 0;
+			for (size_t b = bit >> 3; b < bytes && b < (bit >> 3) + 8; b++)
+				v |= (uint64_t) in[b] << (8 * (b - (bit >> 3)));
+			out[i] = (int) (base + (uint32_t) ((v >> (bit & 7)) & mask));
+		}
+		break;
+	}
+	}
+	return 0;
+}
@@ -0,0 +1,44 @@
+/*
+ * bitpack.h
+ *
+ * Copyright (C) 2016  Akira Kinoshita <kinoshita@nii.ac.jp>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef SRC_LIB_BITPACK_H_
+#define SRC_LIB_BITPACK_H_
+
+#include <stdlib.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/*
+ * Frame-of-reference bit packing of an int array.
+ *
+ * A packed block is a 4-byte little-endian base (the minimum value), a
+ * 1-byte width w (0..32), and then the n values minus base in w bits each,
+ * LSB first.  Widths of 8, 16 and 32 bits are plain little-endian arrays.
+ */
+size_t bitpackBound(size_t n);
+size_t bitpack(const int *in, size_t n, unsigned char *out);
+int bitunpack(const unsigned char *in, size_t bytes, size_t n, int *out);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* SRC_LIB_BITPACK_H_ */
@@ -0,0 +1,111 @@
+/*
+ * format.c
+ *
+ * Copyright (C) 2016  Akira Kinoshita <kinoshita@nii.ac.jp>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+#include "format.h"
+#include <stdio.h>
+#include <string.h>
+#include <math.h>
+
+/* powers of ten that are exact in long double */
+static const long double exactPow10[] = { 1e0L, 1e1L, 1e2L, 1e3L, 1e4L,
+		1e5L, 1e6L, 1e7L, 1e8L, 1e9L, 1e10L, 1e11L, 1e12L, 1e13L, 1e14L,
+		1e15L, 1e16L, 1e17L, 1e18L, 1e19L, 1e20L, 1e21L, 1e22L, 1e23L, 1e24L,
+		1e25L, 1e26L, 1e27L };
+
+/* x * 10^e with a single rounding for small |e| */
+static long double scale10(double x, int e) {
+	if (e >= 0)
+		return (e <= 27) ? x * exactPow10[e] : x * powl(10.0L, e);
+	return (-e <= 27) ? x / exactPow10[-e] : x / powl(10.0L, -e);
+}
+
+/*
+ * The 7 significant digits of %e are the rounded value of |x| * 10^(6 - e)
+ * in [10^6, 10^7).  It is computed in long double, whose error is far below
+ * the distance to the next rounding boundary unless x lies (almost) exactly
+ * between two 7-digit decimals; such values, and non-finite ones, are left
+ * to snprintf().
+ */
+size_t formatExp(char *buf, double x) {
+	double ax = fabs(x);
+	if (!isfinite(x) || ax < 1e-300 || ax > 1e300) {
+		if (x == 0.0 && !signbit(x)) {
+			memcpy(buf, "0.000000e+00", 12);
+			return 12;
+		}
+		return (size_t) snprintf(buf, FORMAT_BUFSIZE, "%e", x);
+	}
+	int e = (int) floor(log10(ax));
+	long double v = scale10(ax, 6 - e);
+	if (v < 1e6L) {
+		v = scale10(ax, 6 - --e);
+	} else if (v >= 1e7L) {
+		v = scale10(ax, 6 - ++e);
+	}
+	long double r = floorl(v);
+	long double frac = v - r;
+	if (fabsl(frac - 0.5L) < 1e-6L)
+		return (size_t) snprintf(buf, FORMAT_BUFSIZE, "%e", x);
+	unsigned long m = (unsigned long) r + (frac > 0.5L);
+	if (m >= 10000000UL) { /* 9.9999995 rounds up to 1.000000e+1 */
+		m /= 10;
+		++e;
+	}
+
+	char *p = buf;
+	if (x < 0.0)
+		*p++ = '-';
+	p[7] = '0' + (char) (m % 10);
+	m /= 10;
+	p[6] = '0' + (char) (m % 10);
+	m /= 10;
+	p[5] = '0' + (char) (m % 10);
+	m /= 10;
+	p[4] = '0' + (char) (m % 10);
+	m /= 10;
+	p[3] = '0' + (char) (m % 10);
+	m /= 10;
+	p[2] = '0' + (char) (m % 10);
+	m /= 10;
+	p[1] = '.';
+	p[0] = '0' + (char) m;
+	p += 8;
+	*p++ = 'e';
+	*p++ = (e < 0) ? '-' : '+';
+	unsigned int ae = (unsigned int) abs(e);
+	if (ae >= 100)
+		*p++ = '0' + (char) (ae / 100);
+	*p++ = '0' + (char) (ae / 10 % 10);
+	*p++ = '0' + (char) (ae % 10);
+	return (size_t) (p - buf);
+}
+
+size_t formatSize(char *buf, size_t x) {
+	char tmp[FORMAT_BUFSIZE];
+	size_t n = 0;
+	do {
+		tmp[n++] = '0' + (char) (x % 10);
+		x /= 10;
+	} while (x > 0);
+	size_t i;
+	for (i = 0; i < n; i++)
+		buf[i] = tmp[n - 1 - i];
+	return n;
+}
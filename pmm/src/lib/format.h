@@ -0,0 +1,44 @@
+/*
+ * format.h
+ *
+ * Copyright (C) 2016  Akira Kinoshita <kinoshita@nii.ac.jp>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+#ifndef SRC_LIB_FORMAT_H_
+#define SRC_LIB_FORMAT_H_
+
+#include <stdlib.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/*
+ * Fast number formatting for large outputs.  formatExp() writes exactly
+ * what printf("%e") writes, and formatSize() what printf("%lu") writes; both
+ * return the number of characters written (no '\0').  buf must hold at
+ * least FORMAT_BUFSIZE characters.
+ */
+#define FORMAT_BUFSIZE 32
+size_t formatExp(char *buf, double x);
+size_t formatSize(char *buf, size_t x);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* SRC_LIB_FORMAT_H_ */
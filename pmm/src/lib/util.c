@@ -17,9 +17,14 @@
  * along with this program.  If not, see <http://www.gnu.org/licenses/>.
  */
 
+#define _GNU_SOURCE /* sched_setaffinity() */
 #include "util.h"
 #include <stdio.h>
 #include <stdlib.h>
+#include <sched.h>
+#ifdef _OPENMP
+#include <omp.h>
+#endif
 
 void die(const char *str) {
 	perror(str);
@@ -41,6 +46,55 @@ double kahanSum(double *a, size_t n) {
 	}
 	return sum;
 }
+
+/*
+ * Add a[0], a[stride], ..., a[(n - 1) * stride] to *sum, carrying the
+ * compensation term in *delta across calls (start with *delta = 0).
+ */
+void kahanAccumulate(double *sum, double *delta, const double *a, size_t n,
+		size_t stride) {
+	double s = *sum, d = *delta;
+	size_t i;
+	for (i = 0; i < n; i++) {
+		double t1 = a[i * stride] - d;
+		double t2 = s + t1;
+		d = (t2 - s) - t1;
+		s = t2;
+	}
+	*sum = s;
+	*delta = d;
+}
 #if defined(__GNUC__)
 #  pragma GCC pop_options
 #endif
+
+/*
+ * Pin OpenMP thread i to the i-th CPU (cyclically) of those the process may
+ * run on, e.g. as restricted by taskset or numactl, so that threads do not
+ * migrate away from the memory they touched first.  Returns the number of
+ * those CPUs, or -1 with errno set.
+ */
+int pinThreads(void) {
+	cpu_set_t allowed;
+	int cpus[CPU_SETSIZE], n = 0, i, ret = 0;
+	if (sched_getaffinity(0, sizeof(allowed), &allowed) != 0)
+		return -1;
+	for (i = 0; i < CPU_SETSIZE; i++) {
+		if (CPU_ISSET(i, &allowed))
+			cpus[n++] = i;
+	}
+#ifdef _OPENMP
+#pragma omp parallel reduction(|:ret)
+#endif
+	{
+		int t = 0;
+		cpu_set_t one;
+#ifdef _OPENMP
+		t = omp_get_thread_num();
+#endif
+		CPU_ZERO(&one);
+		CPU_SET(cpus[t % n], &one);
+		ret |= sched_setaffinity(0, sizeof(one), &one);
+	}
+	return (ret != 0) ? -1 : n;
+}
@@ -28,6 +28,9 @@ extern "C" {
 
 void die(const char *str);
 double kahanSum(double *a, size_t n);
+void kahanAccumulate(double *sum, double *delta, const double *a, size_t n,
+		size_t stride);
+int pinThreads(void);
 
 #ifdef __cplusplus
 }
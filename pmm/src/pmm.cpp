@@ -0,0 +1,257 @@
+/*
+ * pmm.cpp - C interface of libpmm
+ *
+ * Copyright (C) 2016  Akira Kinoshita <kinoshita@nii.ac.jp>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "pmm.h"
+
+#include <cmath>
+#include <cstdio>
+#include <cstring>
+#include <cfloat>
+#include <new>
+#include <string>
+#include <vector>
+#include "class/PoissonMixtureModel.h"
+#include "class/PmmError.h"
+
+struct pmm_model {
+	PoissonMixtureModel tm;
+	std::string error;
+	bool hasData;
+
+	pmm_model(size_t k) :
+			tm(k, 1), hasData(false) {
+	}
+};
+
+/* run f, turning exceptions into a status and the error message */
+template<class F>
+static pmm_status guard(pmm_model *model, F f) {
+	try {
+		f();
+		return PMM_OK;
+	} catch (std::bad_alloc &e) {
+		model->error = "out of memory";
+		return PMM_ERROR_MEMORY;
+	} catch (std::exception &e) {
+		model->error = e.what();
+		return PMM_ERROR_FAILED;
+	}
+}
+
+static pmm_status invalid(pmm_model *model, const char *what) {
+	model->error = what;
+	return PMM_ERROR_ARGUMENT;
+}
+
+/* make records added so far the data set */
+static pmm_status prepare(pmm_model *model) {
+	pmm_status st = guard(model, [&] {
+		model->tm.finishRecords();
+	});
+	if (st != PMM_OK)
+		return st;
+	if (!model->hasData || model->tm.numberOfSegments() == 0) {
+		model->error = "no data";
+		return PMM_ERROR_STATE;
+	}
+	return PMM_OK;
+}
+
+pmm_status pmm_create(size_t k, pmm_model **model) {
+	if (model == NULL || k == 0)
+		return PMM_ERROR_ARGUMENT;
+	*model = NULL;
+	try {
+		*model = new pmm_model(k);
+		(*model)->tm.setThres(1);
+	} catch (std::bad_alloc &e) {
+		return PMM_ERROR_MEMORY;
+	} catch (std::exception &e) {
+		return PMM_ERROR_FAILED;
+	}
+	return PMM_OK;
+}
+
+void pmm_destroy(pmm_model *model) {
+	delete model;
+}
+
+const char *pmm_last_error(const pmm_model *model) {
+	return (model != NULL) ? model->error.c_str() : "no model";
+}
+
+pmm_status pmm_set_min_data(pmm_model *model, size_t n) {
+	if (model == NULL)
+		return PMM_ERROR_ARGUMENT;
+	model->tm.setThres(n);
+	return PMM_OK;
+}
+
+pmm_status pmm_add_records(pmm_model *model, const char * const *ids,
+		const int *values, size_t n) {
+	if (model == NULL)
+		return PMM_ERROR_ARGUMENT;
+	if (n > 0 && (ids == NULL || values == NULL))
+		return invalid(model, "ids and values must not be NULL");
+	for (size_t i = 0; i < n; i++) {
+		if (ids[i] == NULL || values[i] < 0)
+			return invalid(model, "invalid record");
+	}
+	return guard(model, [&] {
+		model->tm.addRecords(ids, values, n);
+		model->hasData = true;
+	});
+}
+
+pmm_status pmm_load_dump(pmm_model *model, const char *path) {
+	if (model == NULL)
+		return PMM_ERROR_ARGUMENT;
+	if (path == NULL)
+		return invalid(model, "path must not be NULL");
+	return guard(model, [&] {
+		model->tm.finishRecords();
+		FILE *fp = fopen(path, "rb");
+		if (fp == NULL)
+			failErrno(path);
+		try {
+			model->tm.loadDataDump(fp);
+		} catch (...) {
+			fclose(fp);
+			throw;
+		}
+		fclose(fp);
+		model->tm.validateDataset();
+		model->hasData = true;
+	});
+}
+
+pmm_status pmm_init(pmm_model *model, const char *method) {
+	if (model == NULL)
+		return PMM_ERROR_ARGUMENT;
+	if (method == NULL || (strcmp(method, "uniform") != 0
+			&& strcmp(method, "quantile") != 0 && strcmp(method, "kmeans") != 0))
+		return invalid(model, "unknown initialization");
+	pmm_status st = prepare(model);
+	if (st != PMM_OK)
+		return st;
+	return guard(model, [&] {
+		model->tm.initDistParams(method);
+	});
+}
+
+/* same convergence test as bin/estimate */
+pmm_status pmm_estimate(pmm_model *model, size_t max_iter, int fixed_iter,
+		pmm_iteration_callback callback, void *arg, size_t *iterations) {
+	if (model == NULL)
+		return PMM_ERROR_ARGUMENT;
+	pmm_status st = prepare(model);
+	if (st != PMM_OK)
+		return st;
+	size_t i = 0;
+	st = guard(model, [&] {
+		double prev = DBL_MIN, now;
+		size_t n_conv = 0;
+		for (i = 0; i < max_iter;) {
+			model->tm.EMAlgorithm();
+			now = model->tm.logLikelihood();
+			++i;
+			if (callback != NULL && callback(i, now, arg) != 0)
+				break;
+			if (!fixed_iter && i > 1) {
+				if (fabs((now - prev) / now) < 0.001) {
+					if (++n_conv >= 3)
+						break;
+				} else {
+					n_conv = 0;
+				}
+			}
+			prev = now;
+		}
+	});
+	if (iterations != NULL)
+		*iterations = i;
+	return st;
+}
+
+pmm_status pmm_log_likelihood(pmm_model *model, double *loglik) {
+	if (model == NULL)
+		return PMM_ERROR_ARGUMENT;
+	if (loglik == NULL)
+		return invalid(model, "loglik must not be NULL");
+	pmm_status st = prepare(model);
+	if (st != PMM_OK)
+		return st;
+	return guard(model, [&] {
+		*loglik = model->tm.logLikelihood();
+	});
+}
+
+size_t pmm_components(const pmm_model *model) {
+	return (model != NULL) ?
+			const_cast<pmm_model *>(model)->tm.numberOfDistParams() : 0;
+}
+
+size_t pmm_segments(const pmm_model *model) {
+	return (model != NULL) ?
+			const_cast<pmm_model *>(model)->tm.numberOfSegments() : 0;
+}
+
+const char *pmm_segment_id(const pmm_model *model, size_t s) {
+	if (s >= pmm_segments(model))
+		return NULL;
+	return const_cast<pmm_model *>(model)->tm.segmentId(s);
+}
+
+pmm_status pmm_get_lambdas(const pmm_model *model, double *lambdas) {
+	if (model == NULL || lambdas == NULL)
+		return PMM_ERROR_ARGUMENT;
+	const_cast<pmm_model *>(model)->tm.getDistParams(lambdas);
+	return PMM_OK;
+}
+
+pmm_status pmm_get_thetas(const pmm_model *model, double *thetas) {
+	if (model == NULL || thetas == NULL)
+		return PMM_ERROR_ARGUMENT;
+	pmm_model *m = const_cast<pmm_model *>(model);
+	size_t k = pmm_components(model);
+	for (size_t s = 0; s < m->tm.numberOfSegments(); s++)
+		m->tm.getTheta(s, thetas + s * k);
+	return PMM_OK;
+}
+
+pmm_status pmm_score(pmm_model *model, const char * const *ids,
+		const int *values, size_t n, double *loglik, double *gamma) {
+	if (model == NULL)
+		return PMM_ERROR_ARGUMENT;
+	if (n > 0 && (ids == NULL || values == NULL || loglik == NULL))
+		return invalid(model, "ids, values and loglik must not be NULL");
+	for (size_t i = 0; i < n; i++) {
+		if (ids[i] == NULL || values[i] < 0)
+			return invalid(model, "invalid record");
+	}
+	size_t k = pmm_components(model);
+	return guard(model, [&] {
+		model->tm.finishRecords();
+		for (size_t i = 0; i < n; i++) {
+			size_t s = model->tm.findSegment(ids[i], strlen(ids[i]));
+			loglik[i] = model->tm.scoreRecord(s, &values[i],
+					gamma != NULL ? gamma + i * k : NULL);
+		}
+	});
+}
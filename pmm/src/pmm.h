@@ -0,0 +1,83 @@
+/*
+ * pmm.h - C interface of libpmm
+ *
+ * Copyright (C) 2016  Akira Kinoshita <kinoshita@nii.ac.jp>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef SRC_PMM_H_
+#define SRC_PMM_H_
+
+#include <stddef.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/*
+ * A Poisson mixture model with its data set.  Functions never exit the
+ * process; they return a status, and pmm_last_error() describes the last
+ * failure.  A model must not be used by several threads at once.
+ */
+typedef struct pmm_model pmm_model;
+
+typedef enum pmm_status {
+	PMM_OK = 0,
+	PMM_ERROR_ARGUMENT, /* invalid argument */
+	PMM_ERROR_STATE, /* not possible now (e.g. no data) */
+	PMM_ERROR_MEMORY, /* out of memory */
+	PMM_ERROR_FAILED /* error while reading or estimating */
+} pmm_status;
+
+/* called after each EM iteration; a non-zero return value stops EM */
+typedef int (*pmm_iteration_callback)(size_t iteration, double loglik,
+		void *arg);
+
+/* a model of k components with random initial lambdas */
+pmm_status pmm_create(size_t k, pmm_model **model);
+void pmm_destroy(pmm_model *model);
+const char *pmm_last_error(const pmm_model *model);
+
+/* data: segments with fewer records than pmm_set_min_data() are dropped */
+pmm_status pmm_set_min_data(pmm_model *model, size_t n);
+pmm_status pmm_add_records(pmm_model *model, const char * const *ids,
+		const int *values, size_t n);
+pmm_status pmm_load_dump(pmm_model *model, const char *path);
+
+/* "uniform" (random), "quantile" or "kmeans"; see bin/estimate --init */
+pmm_status pmm_init(pmm_model *model, const char *method);
+pmm_status pmm_estimate(pmm_model *model, size_t max_iter, int fixed_iter,
+		pmm_iteration_callback callback, void *arg, size_t *iterations);
+pmm_status pmm_log_likelihood(pmm_model *model, double *loglik);
+
+/* results; lambdas are not sorted, and thetas follow their order */
+size_t pmm_components(const pmm_model *model);
+size_t pmm_segments(const pmm_model *model);
+const char *pmm_segment_id(const pmm_model *model, size_t s);
+pmm_status pmm_get_lambdas(const pmm_model *model, double *lambdas);
+pmm_status pmm_get_thetas(const pmm_model *model, double *thetas);
+
+/*
+ * Log-likelihood of each record under the theta of its segment (uniform
+ * for unknown segments), and optionally the n x K responsibilities.
+ */
+pmm_status pmm_score(pmm_model *model, const char * const *ids,
+		const int *values, size_t n, double *loglik, double *gamma);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* SRC_PMM_H_ */
@@ -0,0 +1,175 @@
+/*
+ * pmmbank.cpp - score records with a bank of PMMs, one per time slot
+ *
+ * Copyright (C) 2016  Akira Kinoshita <kinoshita@nii.ac.jp>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <iostream>
+#include <chrono>
+#include <climits>
+#include <cstring>
+#include <string>
+#include <vector>
+#include <boost/program_options.hpp>
+#include "class/ModelBank.h"
+#include "class/PmmError.h"
+#include "lib/util.h"
+
+using namespace std::chrono;
+using namespace boost::program_options;
+
+/* records read but not scored yet */
+struct Batch {
+	std::vector<std::string> ids;
+	std::vector<const char*> idPtrs;
+	std::vector<size_t> lens;
+	std::vector<int> x;
+	std::vector<int64_t> time;
+	std::vector<double> loglik;
+	std::vector<size_t> state;
+	size_t n;
+};
+
+static size_t nRecords = 0, nInvalid = 0;
+
+/*
+ * Parse one "segment,value,timestamp" line (without '\n') into the batch.
+ * Returns false if it is invalid.
+ */
+static bool parseLine(Batch& b, char *line, size_t len) {
+	if (len > 0 && line[len - 1] == '\r')
+		line[--len] = '\0';
+	char *comma = (char *) memchr(line, ',', len);
+	if (comma == NULL)
+		return false;
+	char *end;
+	long x = strtol(comma + 1, &end, 10);
+	if (end == comma + 1 || *end != ',' || x < 0 || x > INT_MAX)
+		return false;
+	char *stamp = end + 1;
+	long long t = strtoll(stamp, &end, 10);
+	if (end == stamp || *end != '\0')
+		return false;
+
+	if (b.ids.size() <= b.n)
+		b.ids.resize(b.n + 1);
+	b.ids[b.n].assign(line, comma - line);
+	b.x[b.n] = (int) x;
+	b.time[b.n] = (int64_t) t;
+	++b.n;
+	return true;
+}
+
+/* score the batch and print "segment,timestamp,slot,state,loglik" lines */
+static void flush(ModelBank& bank, Batch& b) {
+	for (size_t i = 0; i < b.n; i++) {
+		b.idPtrs[i] = b.ids[i].data();
+		b.lens[i] = b.ids[i].size();
+	}
+	bank.score(b.n, b.idPtrs.data(), b.lens.data(), b.x.data(), b.time.data(),
+			b.loglik.data(), b.state.data());
+	for (size_t i = 0; i < b.n; i++) {
+		printf("%s,%lld,%zu,%zu,%e\n", b.ids[i].c_str(), (long long) b.time[i],
+				bank.slotOf(b.time[i]), b.state[i], b.loglik[i]);
+	}
+	nRecords += b.n;
+	b.n = 0;
+}
+
+int main(int argc, char *argv[]) {
+	/* define program options */
+	options_description description1("pmmbank");
+	description1.add_options()
+		("help,h", "help");
+
+	options_description description2("Options");
+	description2.add_options()
+		("model,m", value<std::string>(), "bank file written by bin/estimate --slots")
+		("batch", value<size_t>()->default_value(4096), "number of records scored together");
+	description1.add(description2);
+
+	variables_map vm;
+	try {
+		store(parse_command_line(argc, argv, description1), vm);
+		notify(vm);
+
+		if (vm.count("help")) {
+			std::cout << description1 << std::endl;
+			exit(0);
+		}
+		if (!vm.count("model")) {
+			std::cerr << "a bank file (-m) is required." << std::endl;
+			exit(1);
+		}
+		size_t batchSize = vm["batch"].as<size_t>();
+		if (batchSize == 0) {
+			std::cerr << "--batch must be positive." << std::endl;
+			exit(1);
+		}
+
+		ModelBank bank;
+		FILE *fp = fopen(vm["model"].as<std::string>().c_str(), "r");
+		if (fp == NULL)
+			die("fopen");
+		bank.loadBank(fp);
+		if (fclose(fp) != 0)
+			die("fclose");
+		std::cerr << bank.slots() << " slots, " << bank.size() << " segments"
+				<< std::endl;
+
+		Batch b;
+		b.idPtrs.resize(batchSize);
+		b.lens.resize(batchSize);
+		b.x.resize(batchSize);
+		b.time.resize(batchSize);
+		b.loglik.resize(batchSize);
+		b.state.resize(batchSize);
+		b.n = 0;
+
+		auto start = system_clock::now();
+		char *buf = NULL;
+		size_t bufSize = 0;
+		ssize_t len;
+		while ((len = getline(&buf, &bufSize, stdin)) >= 0) {
+			if (len > 0 && buf[len - 1] == '\n')
+				buf[--len] = '\0';
+			if (len == 0)
+				continue;
+			if (!parseLine(b, buf, len)) {
+				++nInvalid;
+				continue;
+			}
+			if (b.n == batchSize)
+				flush(bank, b);
+		}
+		free(buf);
+		if (ferror(stdin))
+			die("getline");
+		flush(bank, b);
+		auto end = system_clock::now();
+		double sec = duration_cast<microseconds>(end - start).count() * 1e-6;
+		std::cerr << nRecords << " records (" << nInvalid << " invalid) in "
+				<< sec << "s" << std::endl;
+	} catch (PmmError &e) {
+		std::cerr << e.what() << std::endl;
+		exit(1);
+	} catch (std::exception &e) {
+		std::cout << e.what() << std::endl;
+		exit(1);
+	}
+
+	return 0;
+}
@@ -0,0 +1,285 @@
+/*
+ * pmmd.cpp - real-time incident detection with a trained PMM
+ *
+ * Copyright (C) 2016  Akira Kinoshita <kinoshita@nii.ac.jp>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <iostream>
+#include <chrono>
+#include <cerrno>
+#include <cstring>
+#include <cmath>
+#include <algorithm>
+#include <string>
+#include <vector>
+#include <unistd.h>
+#include <poll.h>
+#include <sys/socket.h>
+#include <boost/program_options.hpp>
+#include "class/OnlineDetector.h"
+#include "class/Channel.h"
+#include "class/PmmError.h"
+#include "lib/util.h"
+
+using namespace std::chrono;
+using namespace boost::program_options;
+
+/* records arrive on a descriptor; partial lines are kept until completed */
+struct Input {
+	int fd;
+	std::vector<char> buf;
+	size_t used;
+};
+
+static size_t nRecords = 0, nInvalid = 0, nAlerts = 0;
+
+/*
+ * Ingest-to-alert latency of every record, from the return of the read()
+ * that brought it to the flush of the alerts of that read, in microseconds
+ * (the last bucket counts anything slower).
+ */
+static std::vector<size_t> latency(10001, 0);
+
+static void addLatency(steady_clock::time_point readAt, size_t n) {
+	auto us = duration_cast<microseconds>(steady_clock::now() - readAt).count();
+	latency[std::min((size_t) us, latency.size() - 1)] += n;
+}
+
+/* the p-quantile of the latencies, in whole microseconds */
+static size_t latencyQuantile(double p) {
+	size_t total = 0, c = 0;
+	for (size_t n : latency)
+		total += n;
+	size_t rank = (size_t) std::ceil(p * total);
+	for (size_t us = 0; us < latency.size(); us++) {
+		c += latency[us];
+		if (c >= rank && c > 0)
+			return us;
+	}
+	return 0;
+}
+
+static void printStats(double sec) {
+	std::cerr << nRecords << " records (" << nInvalid << " invalid), "
+			<< nAlerts << " alerts in " << sec << "s, latency p50 "
+			<< latencyQuantile(0.5) << "us, p99 " << latencyQuantile(0.99)
+			<< "us" << std::endl;
+}
+
+/*
+ * Handle one "segment,value[,timestamp]" line (without '\n') and print
+ * "segment,timestamp,state,posterior" if the state of the segment changed.
+ */
+static void processLine(OnlineDetector& detector, char *line, size_t len) {
+	if (len > 0 && line[len - 1] == '\r')
+		line[--len] = '\0';
+	char *comma = (char *) memchr(line, ',', len);
+	if (comma == NULL) {
+		if (len > 0)
+			++nInvalid;
+		return;
+	}
+	char *end;
+	long x = strtol(comma + 1, &end, 10);
+	if (end == comma + 1 || (*end != ',' && *end != '\0') || x < 0) {
+		++nInvalid;
+		return;
+	}
+	const char *timestamp = (*end == ',') ? end + 1 : "";
+	++nRecords;
+
+	double posterior;
+	int state = detector.observe(line, comma - line, (int) x, posterior);
+	if (state < 0)
+		return;
+	++nAlerts;
+	fwrite(line, 1, comma - line, stdout);
+	printf(",%s,%d,%e\n", timestamp, state, posterior);
+}
+
+/*
+ * Read whatever is available on in and process all complete lines.
+ * Returns false on end of file.
+ */
+static bool pump(OnlineDetector& detector, Input& in) {
+	if (in.buf.size() - in.used < 4096)
+		in.buf.resize(in.buf.size() * 2);
+	ssize_t n = read(in.fd, in.buf.data() + in.used, in.buf.size() - in.used - 1);
+	if (n < 0) {
+		if (errno == EINTR || errno == EAGAIN)
+			return true;
+		die("read");
+	}
+	auto readAt = steady_clock::now();
+	size_t before = nRecords;
+	if (n == 0) {
+		/* the last line may lack '\n' */
+		in.buf[in.used] = '\0';
+		processLine(detector, in.buf.data(), in.used);
+		in.used = 0;
+		fflush(stdout);
+		addLatency(readAt, nRecords - before);
+		return false;
+	}
+	in.used += n;
+
+	char *begin = in.buf.data(), *last = begin + in.used;
+	char *nl;
+	while ((nl = (char *) memchr(begin, '\n', last - begin)) != NULL) {
+		*nl = '\0';
+		processLine(detector, begin, nl - begin);
+		begin = nl + 1;
+	}
+	in.used = last - begin;
+	memmove(in.buf.data(), begin, in.used);
+	fflush(stdout);
+	addLatency(readAt, nRecords - before);
+	return true;
+}
+
+static Input newInput(int fd) {
+	Input in;
+	in.fd = fd;
+	in.buf.resize(1 << 16);
+	in.used = 0;
+	return in;
+}
+
+/*
+ * Serve any number of clients on a Unix domain socket, forever; the
+ * statistics so far are printed whenever a client leaves.
+ */
+static void serveSocket(OnlineDetector& detector, const char *path) {
+	auto start = steady_clock::now();
+	int lfd = Channel::listenUnix(path);
+	std::vector<Input> clients;
+	std::vector<struct pollfd> fds;
+	for (;;) {
+		fds.resize(clients.size() + 1);
+		fds[0].fd = lfd;
+		fds[0].events = POLLIN;
+		for (size_t i = 0; i < clients.size(); i++) {
+			fds[i + 1].fd = clients[i].fd;
+			fds[i + 1].events = POLLIN;
+		}
+		if (poll(fds.data(), fds.size(), -1) < 0) {
+			if (errno == EINTR)
+				continue;
+			die("poll");
+		}
+		for (size_t i = clients.size(); i > 0; i--) {
+			if (fds[i].revents == 0)
+				continue;
+			if (!pump(detector, clients[i - 1])) {
+				close(clients[i - 1].fd);
+				clients.erase(clients.begin() + (i - 1));
+				printStats(duration_cast<microseconds>(steady_clock::now()
+						- start).count() * 1e-6);
+			}
+		}
+		if (fds[0].revents & POLLIN) {
+			int c = accept(lfd, NULL, NULL);
+			if (c < 0) {
+				if (errno != EINTR)
+					die("accept");
+			} else {
+				clients.push_back(newInput(c));
+			}
+		}
+	}
+}
+
+int main(int argc, char *argv[]) {
+	/* define program options */
+	options_description description1("pmmd");
+	description1.add_options()
+		("help,h", "help");
+
+	options_description description2("Options");
+	description2.add_options()
+		("model,m", value<std::string>(), "model file written by bin/estimate")
+		("socket", value<std::string>(), "read records from this Unix socket instead of stdin")
+		("window,w", value<size_t>()->default_value(10), "number of recent records per segment")
+		("threshold", value<double>()->default_value(0.5), "posterior of the incident components to raise an alert")
+		("release", value<double>(), "posterior below which an alert is cleared (default: --threshold)")
+		("priorFloor", value<double>()->default_value(1e-4), "raise trained mixing coefficients (e.g. pruned ones) to at least this")
+		("incident", value<std::vector<size_t> >()->multitoken(), "incident components, numbered from 1 by lambda (default: 1)");
+	description1.add(description2);
+
+	variables_map vm;
+	try {
+		store(parse_command_line(argc, argv, description1), vm);
+		notify(vm);
+
+		if (vm.count("help")) {
+			std::cout << description1 << std::endl;
+			exit(0);
+		}
+		if (!vm.count("model")) {
+			std::cerr << "a model file (-m) is required." << std::endl;
+			exit(1);
+		}
+		size_t window = vm["window"].as<size_t>();
+		if (window == 0) {
+			std::cerr << "--window must be positive." << std::endl;
+			exit(1);
+		}
+
+		double threshold = vm["threshold"].as<double>();
+		double release = vm.count("release") ? vm["release"].as<double>() : threshold;
+		if (release > threshold) {
+			std::cerr << "--release must not exceed --threshold." << std::endl;
+			exit(1);
+		}
+
+		double priorFloor = vm["priorFloor"].as<double>();
+		if (!(priorFloor > 0.0 && priorFloor < 1.0)) {
+			std::cerr << "--priorFloor must be in (0, 1)." << std::endl;
+			exit(1);
+		}
+
+		OnlineDetector detector(window, threshold, release, priorFloor);
+		FILE *fp = fopen(vm["model"].as<std::string>().c_str(), "r");
+		if (fp == NULL)
+			die("fopen");
+		detector.loadModel(fp);
+		if (fclose(fp) != 0)
+			die("fclose");
+		if (vm.count("incident"))
+			detector.setIncidentComponents(vm["incident"].as<std::vector<size_t> >());
+		std::cerr << "K = " << detector.K() << ", " << detector.size()
+				<< " segments, window = " << window << std::endl;
+
+		if (vm.count("socket")) {
+			serveSocket(detector, vm["socket"].as<std::string>().c_str());
+		} else {
+			auto start = system_clock::now();
+			Input in = newInput(STDIN_FILENO);
+			while (pump(detector, in))
+				;
+			auto end = system_clock::now();
+			printStats(duration_cast<microseconds>(end - start).count() * 1e-6);
+		}
+	} catch (PmmError &e) {
+		std::cerr << e.what() << std::endl;
+		exit(1);
+	} catch (std::exception &e) {
+		std::cout << e.what() << std::endl;
+		exit(1);
+	}
+
+	return 0;
+}